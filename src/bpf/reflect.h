@@ -0,0 +1,156 @@
+// Reflect rrbench UDP messages back to the client
+//
+// HELOs are answered with an OHHI (without any options), and PINGs are turned
+// into PONGs of the same size, so the client needs to use the same request
+// and response size. Everything else is passed on to the stack.
+//
+// This measures the latency floor of the path to the device the program is
+// attached to, without the socket layer and the server process.
+
+#ifndef RR_BPF_REFLECT_H__
+#define RR_BPF_REFLECT_H__
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+#include "rrbench.h"
+
+// only reflect messages to this UDP port (0: any port)
+#ifndef RR_PORT
+#define RR_PORT 0
+#endif
+
+// update a checksum for @old changing to @new (RFC 1624, eq. 3)
+static __always_inline void
+rr_csum_replace16(__u16 *csum, __u16 old, __u16 new)
+{
+	__u32 sum = (__u16)~*csum + (__u16)~old + new;
+
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	*csum = ~sum;
+}
+
+// The type of the header is at an even offset from the start of the UDP
+// header, so it is the first byte of a 16-bit word, and the rrid spans two
+// 16-bit words. Swapping the addresses and the ports does not change any
+// checksum.
+static __always_inline void
+rr_udp_csum_update(struct udphdr *udp, __u8 old_type, __u8 new_type,
+		   __u32 old_rrid, __u32 new_rrid)
+{
+	__u16 csum = udp->check;
+
+	// no checksum (IPv4 only)
+	if (csum == 0)
+		return;
+
+	rr_csum_replace16(&csum, bpf_htons((__u16)old_type << 8), bpf_htons((__u16)new_type << 8));
+	rr_csum_replace16(&csum, old_rrid & 0xffff, new_rrid & 0xffff);
+	rr_csum_replace16(&csum, old_rrid >> 16, new_rrid >> 16);
+	udp->check = csum ? csum : 0xffff;
+}
+
+static __always_inline bool
+rr_reflect_udp(struct udphdr *udp, void *data_end)
+{
+	struct rr_hdr *rr = (void *)(udp + 1);
+	__u16 len;
+	__u8 type;
+	__u32 rrid;
+
+	if ((void *)(rr + 1) > data_end)
+		return false;
+	if (RR_PORT && udp->dest != bpf_htons(RR_PORT))
+		return false;
+	if (rr->magic != RR_MAGIC)
+		return false;
+
+	len = bpf_ntohs(udp->len);
+	type = rr->type;
+	rrid = rr->rrid;
+	switch (type) {
+	case RR_TYPE_HELO:
+		if (len != sizeof(*udp) + sizeof(*rr) ||
+		    rr->helo.req_size != rr->helo.res_size)
+			return false;
+		rr->type = RR_TYPE_OHHI;
+		rr->rrid = 0;
+		break;
+	case RR_TYPE_PING:
+		if (len != sizeof(*udp) + sizeof(*rr) + rr->ping.dlen)
+			return false;
+		// ->pong.dlen is the same as ->ping.dlen
+		rr->type = RR_TYPE_PONG;
+		break;
+	default:
+		return false;
+	}
+
+	rr_udp_csum_update(udp, type, rr->type, rrid, rr->rrid);
+
+	__be16 port = udp->source;
+	udp->source = udp->dest;
+	udp->dest = port;
+	return true;
+}
+
+// reflect the frame (starting at the ethernet header) in place. Returns
+// true if it was reflected, and should be sent back out of the device it was
+// received from.
+static __always_inline bool
+rr_reflect(void *data, void *data_end)
+{
+	struct ethhdr *eth = data;
+	struct udphdr *udp;
+
+	if ((void *)(eth + 1) > data_end)
+		return false;
+
+	if (eth->h_proto == bpf_htons(ETH_P_IP)) {
+		struct iphdr *ip = (void *)(eth + 1);
+		__be32 addr;
+
+		if ((void *)(ip + 1) > data_end)
+			return false;
+		// no IP options
+		if (ip->ihl != 5 || ip->protocol != IPPROTO_UDP)
+			return false;
+		udp = (void *)(ip + 1);
+		if ((void *)(udp + 1) > data_end || !rr_reflect_udp(udp, data_end))
+			return false;
+
+		addr = ip->saddr;
+		ip->saddr = ip->daddr;
+		ip->daddr = addr;
+	} else if (eth->h_proto == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6 = (void *)(eth + 1);
+		struct in6_addr addr;
+
+		if ((void *)(ip6 + 1) > data_end)
+			return false;
+		// no extension headers
+		if (ip6->nexthdr != IPPROTO_UDP)
+			return false;
+		udp = (void *)(ip6 + 1);
+		if ((void *)(udp + 1) > data_end || !rr_reflect_udp(udp, data_end))
+			return false;
+
+		addr = ip6->saddr;
+		ip6->saddr = ip6->daddr;
+		ip6->daddr = addr;
+	} else {
+		return false;
+	}
+
+	__u8 mac[ETH_ALEN];
+	__builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+	__builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+	__builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+	return true;
+}
+
+#endif /* RR_BPF_REFLECT_H__ */
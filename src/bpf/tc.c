@@ -1,4 +1,3 @@
-
 // #include <linux/skbuff.h>
 // #include <linux/netdevice.h>
 
@@ -6,6 +5,7 @@
 #include <bpf/api.h>
 
 #include "rrbench.h"
+#include "reflect.h"
 
 #ifndef TC_ACT_PIPE
 #define TC_ACT_PIPE 3
@@ -28,4 +28,32 @@ int rr_pull(struct __sk_buff *skb) {
 	return TC_ACT_PIPE;
 }
 
+// tc ingress reflector (see bpf/reflect.h):
+//  tc qdisc add dev $DEV clsact
+//  tc filter add dev $DEV ingress bpf da obj tc.o sec rr-reflect
+__section("rr-reflect")
+int rr_reflect_tc(struct __sk_buff *skb) {
+	__u32 len = ETH_HLEN + sizeof(struct udphdr) + sizeof(struct rr_hdr);
+
+	if (skb->protocol == bpf_htons(ETH_P_IP))
+		len += sizeof(struct iphdr);
+	else if (skb->protocol == bpf_htons(ETH_P_IPV6))
+		len += sizeof(struct ipv6hdr);
+	else
+		return TC_ACT_OK;
+
+	// make sure the headers are in the linear part. Pulling more than the
+	// packet has fails, and a shorter packet is not ours: rr_reflect() checks
+	// everything against data_end.
+	if (len > skb->len)
+		len = skb->len;
+	ctx_pull_data(skb, len);
+
+	if (!rr_reflect(ctx_data(skb), ctx_data_end(skb)))
+		return TC_ACT_OK;
+
+	// back out of the device it came from
+	return redirect(skb->ifindex, 0);
+}
+
 BPF_LICENSE("GPL");
@@ -0,0 +1,17 @@
+#include <bpf/ctx/xdp.h>
+#include <bpf/api.h>
+
+#include "rrbench.h"
+#include "reflect.h"
+
+// XDP reflector (see bpf/reflect.h):
+//  ip link set dev $DEV xdp obj xdp.o sec rr-reflect
+__section("rr-reflect")
+int rr_reflect_xdp(struct xdp_md *ctx) {
+	if (!rr_reflect(ctx_data(ctx), ctx_data_end(ctx)))
+		return XDP_PASS;
+
+	return XDP_TX;
+}
+
+BPF_LICENSE("GPL");
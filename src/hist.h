@@ -0,0 +1,127 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+#ifndef HIST_H__
+#define HIST_H__
+
+// Log-linear (HDR-style) histogram of uint64_t values (e.g., ticks)
+//
+// Values below 2^HIST_SUB_BITS are recorded exactly. Above that, each power
+// of two range is split into 2^(HIST_SUB_BITS-1) linear sub-buckets, so the
+// bucket width is at most 2^-(HIST_SUB_BITS-1) of the value. Values are
+// reported as the bucket midpoint, so the relative error of any percentile is
+// at most 2^-HIST_SUB_BITS (~0.1%). min, max, and the sum are exact.
+//
+// Recording is O(1) and the memory footprint is fixed (sizeof(struct hist),
+// ~220KB), regardless of the number of values. Histograms can be merged, e.g.,
+// to combine per-thread histograms.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS  10
+#define HIST_SUB_COUNT (1UL << HIST_SUB_BITS)
+#define HIST_SUB_HALF  (HIST_SUB_COUNT >> 1)
+// linear buckets for [0, HIST_SUB_COUNT), plus HIST_SUB_HALF buckets for each
+// of the remaining (64 - HIST_SUB_BITS) powers of two
+#define HIST_NBUCKETS  (HIST_SUB_COUNT + (64 - HIST_SUB_BITS)*HIST_SUB_HALF)
+
+struct hist {
+    uint64_t count, sum, min, max;
+    uint64_t buckets[HIST_NBUCKETS];
+};
+
+static inline void
+hist_init(struct hist *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline unsigned
+hist_bucket(uint64_t v) {
+    if (v < HIST_SUB_COUNT)
+        return v;
+
+    // msb >= HIST_SUB_BITS, shift >= 1
+    unsigned msb = 63 - __builtin_clzl(v);
+    unsigned shift = msb - HIST_SUB_BITS + 1;
+    uint64_t sub = (v >> shift) - HIST_SUB_HALF; // [0, HIST_SUB_HALF)
+    return HIST_SUB_COUNT + (shift - 1)*HIST_SUB_HALF + sub;
+}
+
+// lowest value of bucket @b, and its width in @width
+static inline uint64_t
+hist_bucket_low(unsigned b, uint64_t *width) {
+    if (b < HIST_SUB_COUNT) {
+        *width = 1;
+        return b;
+    }
+
+    unsigned shift = (b - HIST_SUB_COUNT) / HIST_SUB_HALF + 1;
+    uint64_t sub = (b - HIST_SUB_COUNT) % HIST_SUB_HALF + HIST_SUB_HALF;
+    *width = 1UL << shift;
+    return sub << shift;
+}
+
+static inline void
+hist_add(struct hist *h, uint64_t v) {
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+// add @src to @dst
+static inline void
+hist_merge(struct hist *dst, const struct hist *src) {
+    for (unsigned i=0; i < HIST_NBUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static inline uint64_t
+hist_avg(const struct hist *h) {
+    return h->count ? h->sum / h->count : 0;
+}
+
+// value at percentile @p (0 < p <= 100), or 0 if the histogram is empty
+static inline uint64_t
+hist_percentile(const struct hist *h, double p) {
+    if (h->count == 0)
+        return 0;
+
+    // rank (1-based) of the value we are looking for
+    uint64_t rank = (uint64_t)((p / 100.0) * (double)h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    else if (rank >= h->count)
+        return h->max;
+
+    uint64_t cnt = 0;
+    for (unsigned b=0; b < HIST_NBUCKETS; b++) {
+        cnt += h->buckets[b];
+        if (cnt >= rank) {
+            uint64_t width, v;
+            v = hist_bucket_low(b, &width) + (width >> 1);
+            if (v < h->min)
+                v = h->min;
+            if (v > h->max)
+                v = h->max;
+            return v;
+        }
+    }
+
+    return h->max;
+}
+
+#endif /* HIST_H__ */
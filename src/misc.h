@@ -171,20 +171,63 @@ ul_hstr(unsigned long ul)
 
 #define xpthread_create(thr, attr, fn, arg) do {        \
         int ret__ = pthread_create(thr, attr, fn, arg); \
-        if (ret__ < 0) {                                \
+        if (ret__ != 0) {                               \
+               errno = ret__;                           \
                perror("pthread_create");                \
                exit(1);                                 \
         }                                               \
 } while (0)
 
-#define xpthread_join(thread, ret) do {      \
-        int ret__ = pthread_join(thr, ret);  \
-        if (ret__ < 0) {                     \
-               perror("pthread_join");       \
-               exit(1);                      \
-        }                                    \
+#define xpthread_join(thread, ret) do {        \
+        int ret__ = pthread_join(thread, ret); \
+        if (ret__ != 0) {                      \
+               errno = ret__;                  \
+               perror("pthread_join");         \
+               exit(1);                        \
+        }                                      \
 } while (0)
 
 #define xpthread_creat(thr, fn, arg) xpthread_create(thr, NULL, fn, arg)
 
+#if defined(__linux__)
+#include <sched.h>
+
+// pin the calling thread to the @n-th (modulo the number of cpus) cpu of the
+// process affinity mask, so that we respect cpusets (e.g., in containers).
+// returns the cpu, or -1 on error
+static inline int
+pin_self_nth_cpu(unsigned n) {
+    cpu_set_t mask, target;
+    int cpu, ncpus;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+
+    ncpus = CPU_COUNT(&mask);
+    if (ncpus == 0)
+        return -1;
+    n %= ncpus;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &mask))
+            continue;
+        if (n-- == 0)
+            break;
+    }
+
+    CPU_ZERO(&target);
+    CPU_SET(cpu, &target);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+    if (err) {
+        errno = err;
+        perror("pthread_setaffinity_np");
+        return -1;
+    }
+
+    return cpu;
+}
+#endif
+
 #endif /* MISC_H__ */
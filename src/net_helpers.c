@@ -5,6 +5,7 @@
 
 #include <netdb.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,9 +13,23 @@
 #include <sys/types.h>
 #include <netdb.h>
 #include <unistd.h> // getopt
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 
 #include "net_helpers.h"
 
+// Linux 6.2, but not always in the installed headers
+#ifndef SOF_TIMESTAMPING_OPT_ID_TCP
+#define SOF_TIMESTAMPING_OPT_ID_TCP (1 << 16)
+#endif
+
 // set the service field of the URL
 // might leak data, does not check/set ->serv
 void url_set_service__(struct url *url, const char *service);
@@ -52,6 +67,25 @@ int url_parse(struct url *url, const char *url_str)
     } else
         url->prot = NULL;
 
+    // IPv6 addresses: [addr]:service
+    if (input[0] == '[' && (s = strchr(input, ']')) != NULL) {
+        size_t len = s - input - 1;
+        url->node = malloc(len + 1);
+        if (!url->node) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(url->node, input + 1, len);
+        url->node[len] = '\0';
+        input = s + 1;
+        if (strncmp(input, service_sep, strlen(service_sep)) != 0) {
+            url->serv = NULL;
+            return 0;
+        }
+        url_set_service__(url, input + strlen(service_sep));
+        return 0;
+    }
+
     if ((s = strstr(input, service_sep)) != NULL) {
         size_t len = s - input;
         url->node = malloc(len + 1);
@@ -80,9 +114,66 @@ int url_parse(struct url *url, const char *url_str)
     return 0;
 }
 
+// unix sockets: the node is the path of the (listening) socket, and the
+// service is the pid of the peer
+static int url_from_unix_peer(struct url *url, int sockfd, int type)
+{
+    struct sockaddr_un sun;
+    socklen_t sun_len = sizeof(sun);
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+
+    url->prot = strdup(type == SOCK_SEQPACKET ? "unixpacket" : "unix");
+    url->node = malloc(sizeof(sun.sun_path) + 1);
+    url->serv = malloc(16);
+    if (!url->prot || !url->node || !url->serv) {
+        perror("malloc");
+        exit(1);
+    }
+
+    if (getsockname(sockfd, (struct sockaddr *)&sun, &sun_len) == -1) {
+        perror("getsockname");
+        goto fail_free;
+    }
+    size_t len = sun_len - offsetof(struct sockaddr_un, sun_path);
+    if (len > 0 && sun.sun_path[0] == '\0') {
+        // abstract: @name
+        memcpy(url->node, sun.sun_path, len);
+        url->node[0] = '@';
+        url->node[len] = '\0';
+    } else {
+        len = strnlen(sun.sun_path, len);
+        memcpy(url->node, sun.sun_path, len);
+        url->node[len] = '\0';
+    }
+
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1) {
+        perror("getsockopt(SO_PEERCRED)");
+        goto fail_free;
+    }
+    snprintf(url->serv, 16, "%d", (int)cred.pid);
+    return 0;
+
+fail_free:
+    url_free_fields(url);
+    return -1;
+}
+
 int url_from_peer(struct url *url, int sockfd,
                   struct sockaddr *peer_addr, socklen_t peer_addr_size) {
 
+    struct sockaddr_storage local;
+    socklen_t local_len = sizeof(local);
+    if (getsockname(sockfd, (struct sockaddr *)&local, &local_len) == 0 &&
+        local.ss_family == AF_UNIX) {
+        int type;
+        socklen_t type_len = sizeof(type);
+        if (getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &type_len) == -1) {
+            perror("getsockopt");
+            return -1;
+        }
+        return url_from_unix_peer(url, sockfd, type);
+    }
 
     const size_t prot_size = 4;   // TCP/UDP
     url->prot = malloc(prot_size);
@@ -91,14 +182,14 @@ int url_from_peer(struct url *url, int sockfd,
         exit(1);
     }
 
-    const size_t node_size = 16;  // xxx.xxx.xxx.xxx
+    const size_t node_size = 46;  // INET6_ADDRSTRLEN
     url->node = malloc(node_size);
     if (!url->node) {
         perror("malloc");
         exit(1);
     }
 
-    const size_t serv_size = 5;   // 65535
+    const size_t serv_size = 6;   // 65535
     url->serv = malloc(serv_size);
     if (!url->serv) {
         perror("malloc");
@@ -119,10 +210,10 @@ int url_from_peer(struct url *url, int sockfd,
         strcpy(url->prot, "udp");
     } else {
         fprintf(stderr, "%s: Unknown socket type:%d\n", __FUNCTION__, opt);
-        strcpy("???", url->prot);
+        strcpy(url->prot, "???");
     }
 
-    struct sockaddr_in peer_addr__;
+    struct sockaddr_storage peer_addr__;
     if (peer_addr == NULL) {
         peer_addr_size = sizeof(peer_addr__);
         peer_addr = (struct sockaddr *)&peer_addr__;
@@ -137,8 +228,8 @@ int url_from_peer(struct url *url, int sockfd,
                       url->node, node_size,
                       url->serv, serv_size,
                       NI_NUMERICHOST | NI_NUMERICSERV);
-    if (err == -1) {
-        perror("getnameinfo");
+    if (err != 0) {
+        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(err));
         goto fail_free;
     }
 
@@ -239,11 +330,48 @@ void url_free(struct url *url)
     free(url);
 }
 
+// a single AF_UNIX addrinfo for @path ("@name" for the abstract namespace),
+// allocated like getaddrinfo() does, so that it can be freed with
+// freeaddrinfo()
+static struct addrinfo *unix_addrinfo(const char *path, int socktype)
+{
+    struct addrinfo *ai;
+    struct sockaddr_un *sun;
+    size_t len = strlen(path);
+
+    if (len == 0 || len >= sizeof(sun->sun_path)) {
+        fprintf(stderr, "invalid unix socket path: %s\n", path);
+        return NULL;
+    }
+
+    ai = calloc(1, sizeof(*ai) + sizeof(*sun));
+    if (!ai) {
+        perror("calloc");
+        exit(1);
+    }
+    sun = (struct sockaddr_un *)(ai + 1);
+    sun->sun_family = AF_UNIX;
+    memcpy(sun->sun_path, path, len);
+    if (path[0] == '@')
+        sun->sun_path[0] = '\0';
+
+    ai->ai_family = AF_UNIX;
+    ai->ai_socktype = socktype;
+    ai->ai_protocol = 0;
+    ai->ai_addr = (struct sockaddr *)sun;
+    // abstract addresses are not NUL-terminated
+    ai->ai_addrlen = offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1);
+    return ai;
+}
+
 // valid URLs:
 //  {udp,tcp}://147.102.3.1:1234
 //  {udp,tcp}://*:1234
 //  147.102.3.1:1234
 //  *:1234
+//  unix:///path/to/socket, unixpacket:///path/to/socket (SOCK_SEQPACKET),
+//  unix://@name (abstract)
+//  shm://name: unix socket @rrbench-shm-name (see shm.h)
 struct addrinfo *url_getaddrinfo(struct url *url, bool srv)
 {
     struct addrinfo hints = (struct addrinfo){0};
@@ -261,6 +389,16 @@ struct addrinfo *url_getaddrinfo(struct url *url, bool srv)
     } else if (strcmp(url->prot, "tcp") == 0) {
         hints.ai_socktype = SOCK_STREAM;
         hints.ai_family = AF_UNSPEC;
+    } else if (strcmp(url->prot, "unix") == 0 || strcmp(url->prot, "unixpacket") == 0) {
+        // url_parse() splits at the first ':'
+        char path[128];
+        snprintf(path, sizeof(path), "%s%s%s", url->node ? url->node : "",
+                 url->serv ? ":" : "", url->serv ? url->serv : "");
+        return unix_addrinfo(path, strcmp(url->prot, "unix") == 0 ? SOCK_STREAM : SOCK_SEQPACKET);
+    } else if (strcmp(url->prot, "shm") == 0) {
+        char path[128];
+        snprintf(path, sizeof(path), "@rrbench-shm-%s", url->node ? url->node : "");
+        return unix_addrinfo(path, SOCK_STREAM);
     } else {
         fprintf(stderr, "Unknown protocol: %s\n", url->prot);
         return NULL;
@@ -303,7 +441,7 @@ void sa_add_to_port(struct sockaddr *sa, int add)
 
 // try to bind an addrinfo, but do not iterate
 // returns -1 if bind fails
-int do_ai_bind(struct addrinfo *ai)
+int do_ai_bind(struct addrinfo *ai, unsigned flags)
 {
     int fd;
 
@@ -320,6 +458,20 @@ int do_ai_bind(struct addrinfo *ai)
         return -1;
     }
 
+    // remove a stale socket file
+    if (ai->ai_family == AF_UNIX) {
+        const char *path = ((struct sockaddr_un *)ai->ai_addr)->sun_path;
+        if (path[0] != '\0' && unlink(path) == -1 && errno != ENOENT)
+            perror("unlink");
+    }
+
+    if ((flags & AI_BIND_REUSEPORT) &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &o, sizeof(o)) == -1) {
+        close(fd);
+        perror("setsockopt(SO_REUSEPORT)");
+        return -1;
+    }
+
     if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
         close(fd);
         return -1;
@@ -331,12 +483,18 @@ int do_ai_bind(struct addrinfo *ai)
 // bind an addrinfo, returns fd
 // if @addr_ptr is set, it places the addrinfo list element used to bind
 int ai_bind(struct addrinfo *addr, struct addrinfo **addr_ptr)
+{
+    return ai_bind_flags(addr, addr_ptr, 0);
+}
+
+// same as ai_bind(), but pass AI_BIND_* @flags to do_ai_bind()
+int ai_bind_flags(struct addrinfo *addr, struct addrinfo **addr_ptr, unsigned flags)
 {
     int fd;
     struct addrinfo *ai;
     for (ai = addr; ai != NULL; ai = ai->ai_next) {
 
-        fd = do_ai_bind(ai);
+        fd = do_ai_bind(ai, flags);
         if (!(fd < 0))
             break;
 
@@ -435,3 +593,208 @@ uint16_t sock_getport(int sockfd)
         return -1;
     }
 }
+
+int addr_ifname(const struct sockaddr *addr, char *ifname)
+{
+    struct ifaddrs *ifas, *ifa;
+    int ret = -1;
+
+    if (getifaddrs(&ifas) == -1) {
+        perror("getifaddrs");
+        return -1;
+    }
+
+    for (ifa = ifas; ifa != NULL; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != addr->sa_family)
+            continue;
+        if (addr->sa_family == AF_INET &&
+            ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr ==
+            ((struct sockaddr_in *)addr)->sin_addr.s_addr)
+            break;
+        if (addr->sa_family == AF_INET6 &&
+            memcmp(&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr,
+                   &((struct sockaddr_in6 *)addr)->sin6_addr, sizeof(struct in6_addr)) == 0)
+            break;
+    }
+
+    if (ifa != NULL) {
+        strncpy(ifname, ifa->ifa_name, IFNAMSIZ - 1);
+        ifname[IFNAMSIZ - 1] = '\0';
+        ret = 0;
+    }
+
+    freeifaddrs(ifas);
+    return ret;
+}
+
+// enable hardware timestamping on the device that has the local address of
+// @sockfd. Needs CAP_NET_ADMIN, and a NIC that supports it.
+static int sock_hwtstamp_enable(int sockfd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    char ifname[IFNAMSIZ];
+
+    if (getsockname(sockfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+        perror("getsockname");
+        return -1;
+    }
+
+    if (addr_ifname((struct sockaddr *)&addr, ifname) == -1) {
+        fprintf(stderr, "hardware timestamps: no device for local address\n");
+        return -1;
+    }
+
+    struct hwtstamp_config cfg = {
+        .tx_type = HWTSTAMP_TX_ON,
+        .rx_filter = HWTSTAMP_FILTER_ALL,
+    };
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    ifr.ifr_data = (void *)&cfg;
+    if (ioctl(sockfd, SIOCSHWTSTAMP, &ifr) == -1) {
+        fprintf(stderr, "hardware timestamps: SIOCSHWTSTAMP(%s): %s\n", ifname, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int sock_tstamp_enable(int sockfd, bool hw)
+{
+    unsigned flags = SOF_TIMESTAMPING_SOFTWARE |
+                     SOF_TIMESTAMPING_RX_SOFTWARE |
+                     SOF_TIMESTAMPING_TX_SOFTWARE |
+                     SOF_TIMESTAMPING_OPT_ID |
+                     SOF_TIMESTAMPING_OPT_TSONLY;
+    int ret = 0, type;
+    socklen_t len = sizeof(type);
+
+    // Without OPT_ID_TCP, TCP keys start at snd_una, so bytes sent but not
+    // yet acked when timestamps are enabled would shift every key
+    if (getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &len) == -1) {
+        perror("getsockopt(SO_TYPE)");
+        return -1;
+    }
+    if (type == SOCK_STREAM)
+        flags |= SOF_TIMESTAMPING_OPT_ID_TCP;
+
+    if (hw && sock_hwtstamp_enable(sockfd) == 0) {
+        // OPT_TX_SWHW: we still want software TX timestamps
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE |
+                 SOF_TIMESTAMPING_RX_HARDWARE |
+                 SOF_TIMESTAMPING_TX_HARDWARE |
+                 SOF_TIMESTAMPING_OPT_TX_SWHW;
+        ret = 1;
+    }
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+        if (errno == EINVAL && (flags & SOF_TIMESTAMPING_OPT_ID_TCP))
+            fprintf(stderr, "SO_TIMESTAMPING: SOF_TIMESTAMPING_OPT_ID_TCP not supported (needs Linux >= 6.2)\n");
+        else
+            perror("setsockopt(SO_TIMESTAMPING)");
+        return -1;
+    }
+
+    return ret;
+}
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec*1000000000ULL + ts->tv_nsec;
+}
+
+void sock_tstamp_from_cmsg(struct msghdr *msg, struct sock_tstamp *ts)
+{
+    struct cmsghdr *cmsg;
+
+    ts->sw = ts->hw = 0;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+            ts->sw = timespec_ns(&tss.ts[0]);
+            ts->hw = timespec_ns(&tss.ts[2]);
+        }
+    }
+}
+
+int sock_tstamp_read_tx(int sockfd, uint32_t *key, struct sock_tstamp *ts)
+{
+    char control[512];
+
+    for (;;) {
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        sock_tstamp_from_cmsg(&msg, ts);
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                *key = err.ee_data;
+                return 1;
+            }
+        }
+        // not a timestamp: skip it
+    }
+}
+
+int sock_zerocopy_enable(int sockfd)
+{
+    int one = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) {
+        perror("setsockopt(SO_ZEROCOPY)");
+        return -1;
+    }
+    return 0;
+}
+
+int sock_zerocopy_read(int sockfd, uint32_t *lo, uint32_t *hi, bool *copied)
+{
+    char control[128];
+
+    for (;;) {
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno == 0 && err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                *lo = err.ee_info;
+                *hi = err.ee_data;
+                *copied = err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+                return 1;
+            }
+        }
+        // not a zero-copy completion: skip it
+    }
+}
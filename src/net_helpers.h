@@ -6,6 +6,7 @@
 #define NET_HELPERS_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netdb.h>
@@ -29,14 +30,18 @@ struct url {
 // valid URLs:
 //  {udp,tcp}://147.102.3.1:1234
 //  {udp,tcp}://*:1234
+//  {udp,tcp}://[fd00::1]:1234
 //  147.102.3.1:1234
 //  *:1234
+//  {unix,unixpacket}:///path/to/socket, unix://@abstract-name
+//  shm://name
 int url_parse(struct url *url, const char *url_str);
 // returns url or null
 struct url *url_alloc_parse(const char *url_str);
 
 // generate a URL from a sockset
 //
+// For unix sockets, the node is the local path, and the service the peer pid.
 // If peer_addr is NULL, the function will call getpeername()
 // Otherwise, it will use peer_addr, and peer_addr_size to call getnameinfo()
 //
@@ -62,11 +67,66 @@ struct addrinfo *url_getaddrinfo(struct url *url, bool srv);
 // if @addr_ptr is set, it places the addrinfo list element used to bind
 int ai_bind(struct addrinfo *addr, struct addrinfo **addr_ptr);
 
+// ai_bind() flags
+#define AI_BIND_REUSEPORT 0x1 // set SO_REUSEPORT before binding
+
+// same as ai_bind(), but with AI_BIND_* @flags
+int ai_bind_flags(struct addrinfo *addr, struct addrinfo **addr_ptr, unsigned flags);
+
+// try to bind an addrinfo, but do not iterate
+// returns -1 if bind fails
+int do_ai_bind(struct addrinfo *ai, unsigned flags);
+
 // connect to an addrinfo, return fd
 // if @addr_ptr is set, it places the addrinfo list element used to connect
 // returns -1 if error
 int ai_connect(struct addrinfo *addr, struct addrinfo **addr_ptr);
 
+// find the name of the device that has the local address @addr (IPv4 or
+// IPv6). @ifname should have space for IFNAMSIZ bytes.
+// returns 0, or -1 if there is no such device
+int addr_ifname(const struct sockaddr *addr, char *ifname);
+
+// Kernel timestamps (SO_TIMESTAMPING)
+//
+// Timestamps are in nsecs, or 0 if not available. Software timestamps are in
+// CLOCK_REALTIME. Hardware timestamps are in the NIC's clock, so they are only
+// comparable with hardware timestamps of the same (or a synchronized) NIC.
+struct sock_tstamp {
+    uint64_t sw, hw;
+};
+
+// enable software RX and TX timestamps on @sockfd. TX timestamps are keyed
+// with SOF_TIMESTAMPING_OPT_ID (for TCP, with SOF_TIMESTAMPING_OPT_ID_TCP,
+// the offset of the last byte of each send() since timestamps were enabled,
+// regardless of unacked data). If @hw is set, also try to enable
+// hardware timestamps on the device of the socket's local address.
+// returns 1 if hardware timestamps were enabled, 0 if only software ones
+// were, or -1 on error
+int sock_tstamp_enable(int sockfd, bool hw);
+
+// get the timestamps of a received message from its control data
+void sock_tstamp_from_cmsg(struct msghdr *msg, struct sock_tstamp *ts);
+
+// read the next TX timestamp from the error queue, without blocking
+// returns 1 (and sets @key, @ts), 0 if there are none, or -1 on error
+int sock_tstamp_read_tx(int sockfd, uint32_t *key, struct sock_tstamp *ts);
+
+// Zero-copy sends (SO_ZEROCOPY, MSG_ZEROCOPY)
+//
+// Each successful send() with MSG_ZEROCOPY gets an id (a counter that starts
+// at 0 for each socket), and the kernel reports completed sends as ranges of
+// ids in the error queue.
+
+// returns 0, or -1 on error
+int sock_zerocopy_enable(int sockfd);
+
+// read the next completion from the error queue, without blocking: sends
+// [@lo, @hi] completed, and @copied is set if the kernel copied their data
+// (e.g., over loopback).
+// returns 1, 0 if there are none, or -1 on error
+int sock_zerocopy_read(int sockfd, uint32_t *lo, uint32_t *hi, bool *copied);
+
 #if defined(__cplusplus)
 } // end  extern "C"
 #endif
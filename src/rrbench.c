@@ -7,13 +7,31 @@
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 
 #include "rrbench.h"
 #include "net_helpers.h"
 #include "tsc.h"
+#include "hist.h"
 #include "misc.h"
+#include "uring.h"
+#include "xsk.h"
+#include "shm.h"
+#include "trace.h"
 
-#define RR_MAGIC 0xfae1fae2
 #define RR_MAX_SIZE 1024
 
 static void
@@ -41,308 +59,4721 @@ rr_init_pong(struct rr_hdr *hdr, uint32_t rrid, uint16_t dlen) {
     hdr->pong.dlen = dlen;
 }
 
+/**
+ * PING/PONG accessors for both protocol versions
+ *
+ * Stream transports negotiate the version in the HELO (RR_OPT_V2), and pass
+ * it (@v2) to these. UDP and XDP only speak v1, and use struct rr_hdr
+ * directly.
+ */
+
+#define RR_V1_MAX_SIZE 0xffffU
+
+// bytes on the wire for a message with @dlen bytes after the header
+static inline size_t
+rr_msg_size(bool v2, size_t dlen) {
+    if (!v2)
+        return sizeof(struct rr_hdr) + dlen;
+    return sizeof(struct rr_hdr2) + ((dlen + 7) & ~(size_t)7);
+}
+
+// initialize a PING or PONG with a payload of @dlen bytes
+static inline void
+rr_msg_init(bool v2, void *msg, uint8_t type, uint64_t rrid, uint32_t dlen) {
+    if (!v2) {
+        if (type == RR_TYPE_PING)
+            rr_init_ping(msg, rrid, dlen);
+        else
+            rr_init_pong(msg, rrid, dlen);
+        return;
+    }
+
+    struct rr_hdr2 *hdr = msg;
+    *hdr = (struct rr_hdr2){
+        .magic = RR_MAGIC2,
+        .type = type,
+        .dlen = dlen,
+        .rrid = rrid,
+    };
+}
+
+static inline bool
+rr_msg_is(bool v2, const void *msg, uint8_t type) {
+    if (!v2) {
+        const struct rr_hdr *hdr = msg;
+        return hdr->magic == RR_MAGIC && hdr->type == type;
+    }
+    const struct rr_hdr2 *hdr = msg;
+    return hdr->magic == RR_MAGIC2 && hdr->type == type;
+}
+
+static inline uint64_t
+rr_msg_rrid(bool v2, const void *msg) {
+    return v2 ? ((const struct rr_hdr2 *)msg)->rrid : ((const struct rr_hdr *)msg)->rrid;
+}
+
+static inline uint32_t
+rr_msg_dlen(bool v2, const void *msg) {
+    return v2 ? ((const struct rr_hdr2 *)msg)->dlen : ((const struct rr_hdr *)msg)->pong.dlen;
+}
+
+static inline void *
+rr_msg_data(bool v2, void *msg) {
+    return v2 ? ((struct rr_hdr2 *)msg)->data : ((struct rr_hdr *)msg)->data;
+}
+
+// set the id (and the timestamp, for v2) of a PING
+static inline void
+rr_msg_set_ping(bool v2, void *msg, uint64_t rrid, uint64_t tstamp) {
+    if (!v2) {
+        ((struct rr_hdr *)msg)->rrid = rrid;
+        return;
+    }
+    ((struct rr_hdr2 *)msg)->rrid = rrid;
+    ((struct rr_hdr2 *)msg)->tstamp = tstamp;
+}
+
+// fill in a PONG for the PING @req
+static inline void
+rr_msg_reply(bool v2, void *res, const void *req) {
+    if (!v2) {
+        ((struct rr_hdr *)res)->rrid = ((const struct rr_hdr *)req)->rrid;
+        return;
+    }
+    ((struct rr_hdr2 *)res)->rrid = ((const struct rr_hdr2 *)req)->rrid;
+    ((struct rr_hdr2 *)res)->tstamp = ((const struct rr_hdr2 *)req)->tstamp;
+}
+
+/**
+ * Shared memory transport (shm://)
+ *
+ * A shm connection is a unix socket (the control socket) and a shared memory
+ * channel that carries the messages (see shm.h). Channels are looked up by
+ * the fd of their control socket, so that the code that sends and receives
+ * with rr_send() and rr_recv() works unchanged for all stream transports.
+ *
+ * shm channels cannot be poll()ed: they either spin or sleep on a futex
+ * (depending on @spin) when a blocking call waits.
+ */
+
+#define RR_SHM_MAX_FDS 4096
+
+static struct shm_chan *rr_shm_chans[RR_SHM_MAX_FDS];
+
+static inline struct shm_chan *
+rr_shm_chan(int fd) {
+    return (fd >= 0 && fd < RR_SHM_MAX_FDS) ? rr_shm_chans[fd] : NULL;
+}
+
+static struct shm_chan *
+rr_shm_register(int fd) {
+    if (fd < 0 || fd >= RR_SHM_MAX_FDS)
+        die("shm: fd %d out of range\n", fd);
+
+    rr_shm_chans[fd] = xmalloc(sizeof(struct shm_chan));
+    return rr_shm_chans[fd];
+}
+
+// client: create the channel of control socket @fd
+static void
+rr_shm_connect(int fd, bool spin) {
+    struct shm_chan *ch = rr_shm_register(fd);
+    int err = shm_chan_connect(ch, fd, SHM_RING_SIZE_DEFAULT, spin);
+    if (err < 0)
+        die("shm_chan_connect: %s\n", strerror(-err));
+}
+
+// server: receive the channel of control socket @fd
+static void
+rr_shm_accept(int fd, bool spin) {
+    struct shm_chan *ch = rr_shm_register(fd);
+    int err = shm_chan_accept(ch, fd, spin);
+    if (err < 0)
+        die("shm_chan_accept: %s\n", strerror(-err));
+}
+
+// close the channel of @fd, if any. Should be called before close(@fd).
+static void
+rr_shm_close(int fd) {
+    struct shm_chan *ch = rr_shm_chan(fd);
+    if (!ch)
+        return;
+
+    shm_chan_close(ch);
+    free(ch);
+    rr_shm_chans[fd] = NULL;
+}
+
+// send(), or shm_chan_send() for shm connections (flags: MSG_DONTWAIT)
+static ssize_t
+rr_send(int fd, const void *buf, size_t len, int flags) {
+    struct shm_chan *ch = rr_shm_chan(fd);
+    if (!ch)
+        return send(fd, buf, len, flags);
+
+    return shm_chan_send(ch, buf, len, !(flags & MSG_DONTWAIT));
+}
+
+// recv(), or shm_chan_recv() for shm connections (flags: MSG_DONTWAIT,
+// MSG_WAITALL)
+static ssize_t
+rr_recv(int fd, void *buf, size_t len, int flags) {
+    struct shm_chan *ch = rr_shm_chan(fd);
+    if (!ch)
+        return recv(fd, buf, len, flags);
+
+    if (!(flags & MSG_WAITALL))
+        return shm_chan_recv(ch, buf, len, !(flags & MSG_DONTWAIT));
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t ret = shm_chan_recv(ch, (char *)buf + off, len - off, true);
+        if (ret <= 0)
+            return off > 0 ? (ssize_t)off : ret;
+        off += ret;
+    }
+    return off;
+}
+
+/**
+ * Receive buffer
+ *
+ * TCP does not preserve message boundaries: a single recv() might return
+ * many messages, or only part of one. We read as much as fits in one
+ * syscall, and then parse all the complete frames in the buffer. A partial
+ * frame at the end is moved to the start of the buffer before the next read.
+ */
+
+// upper bound for the size of per-connection send and receive buffers
+#define RR_BUFF_MAX (256*1024)
+
+struct rr_rbuf {
+    char *buf;
+    size_t cap, start, end; // [start, end) holds unparsed data
+};
+
+static void
+rr_rbuf_init(struct rr_rbuf *rb, size_t cap) {
+    rb->buf = xmalloc(cap);
+    rb->cap = cap;
+    rb->start = rb->end = 0;
+}
+
+static void
+rr_rbuf_fini(struct rr_rbuf *rb) {
+    free(rb->buf);
+}
+
+// move unparsed data to the start of the buffer
+static inline void
+rr_rbuf_compact(struct rr_rbuf *rb) {
+    if (rb->start > 0) {
+        rb->end -= rb->start;
+        memmove(rb->buf, rb->buf + rb->start, rb->end);
+        rb->start = 0;
+    }
+    assert(rb->end < rb->cap);
+}
+
+// recv() into the free space of the buffer
+static ssize_t
+rr_rbuf_recv(struct rr_rbuf *rb, int fd, int flags) {
+    rr_rbuf_compact(rb);
+    ssize_t ret = rr_recv(fd, rb->buf + rb->end, rb->cap - rb->end, flags);
+    if (ret > 0)
+        rb->end += ret;
+    return ret;
+}
+
+// same as rr_rbuf_recv(), but also return the kernel RX timestamps of the
+// received data in @ts (for TCP, those of the last segment read)
+static ssize_t
+rr_rbuf_recv_tstamp(struct rr_rbuf *rb, int fd, int flags, struct sock_tstamp *ts) {
+    char control[256];
+    struct iovec iov;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+
+    rr_rbuf_compact(rb);
+    iov.iov_base = rb->buf + rb->end;
+    iov.iov_len = rb->cap - rb->end;
+    ssize_t ret = recvmsg(fd, &msg, flags);
+    if (ret > 0) {
+        rb->end += ret;
+        sock_tstamp_from_cmsg(&msg, ts);
+    }
+    return ret;
+}
+
+// returns the next @size bytes, without consuming them, or NULL
+static inline void *
+rr_rbuf_peek(struct rr_rbuf *rb, size_t size) {
+    return rb->end - rb->start < size ? NULL : rb->buf + rb->start;
+}
+
+// returns the next complete frame of @size bytes, or NULL
+static inline void *
+rr_rbuf_next(struct rr_rbuf *rb, size_t size) {
+    if (rb->end - rb->start < size)
+        return NULL;
+
+    char *frame = rb->buf + rb->start;
+    rb->start += size;
+    return frame;
+}
+
+// buffer capacity for frames of @size bytes: room for @n of them, but at most
+// RR_BUFF_MAX (and at least one frame)
+static size_t
+rr_buff_cap(size_t size, size_t n) {
+    size_t max = MAX(RR_BUFF_MAX / size, 1UL);
+    return MIN(n, max)*size;
+}
+
+/**
+ * Wait strategies
+ *
+ * How a thread waits for messages to arrive:
+ *  block:     blocking recv()
+ *  poll:      non-blocking recv(), and poll() (or epoll_wait()) when there is
+ *             nothing to receive
+ *  spin:      non-blocking recv() in a loop, never sleeping in the kernel
+ *  busy-poll: like block, but sockets have SO_BUSY_POLL and
+ *             SO_PREFER_BUSY_POLL set, so the kernel busy-polls the device
+ *             queue before putting the thread to sleep
+ */
+
+enum rr_wait {
+    RR_WAIT_BLOCK = 0,
+    RR_WAIT_POLL,
+    RR_WAIT_SPIN,
+    RR_WAIT_BUSY_POLL,
+};
+
+#define RR_BUSY_POLL_USECS 50
+
+static enum rr_wait
+rr_wait_parse(const char *str) {
+    if (strcmp(str, "block") == 0)
+        return RR_WAIT_BLOCK;
+    else if (strcmp(str, "poll") == 0)
+        return RR_WAIT_POLL;
+    else if (strcmp(str, "spin") == 0)
+        return RR_WAIT_SPIN;
+    else if (strcmp(str, "busy-poll") == 0)
+        return RR_WAIT_BUSY_POLL;
+    die("unknown wait strategy: %s\n", str);
+    abort();
+}
+
+// does @wait sleep in blocking syscalls?
+static inline bool
+rr_wait_blocks(enum rr_wait wait) {
+    return wait == RR_WAIT_BLOCK || wait == RR_WAIT_BUSY_POLL;
+}
+
+// socket setup for @wait
+static void
+rr_wait_setup(int fd, enum rr_wait wait) {
+    static bool warned = false;
+    int usecs = RR_BUSY_POLL_USECS, one = 1;
+
+    if (wait != RR_WAIT_BUSY_POLL)
+        return;
+
+    // Raising SO_BUSY_POLL requires CAP_NET_ADMIN, and SO_PREFER_BUSY_POLL
+    // Linux 5.11. Warn (once), but keep going.
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) == -1 &&
+        !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED))
+        perror("setsockopt(SO_BUSY_POLL)");
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) == -1 &&
+        !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED))
+        perror("setsockopt(SO_PREFER_BUSY_POLL)");
+}
+
+// wait until @fd is ready for @events
+static void
+rr_wait_poll(int fd, short events) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+        die_perr("poll");
+}
+
+// rr_rbuf_recv(), waiting for data according to @wait. shm channels wait on
+// their own (see rr_shm_accept()).
+static ssize_t
+rr_rbuf_recv_wait(struct rr_rbuf *rb, int fd, enum rr_wait wait) {
+    if (rr_wait_blocks(wait) || rr_shm_chan(fd))
+        return rr_rbuf_recv(rb, fd, 0);
+
+    for (;;) {
+        ssize_t ret = rr_rbuf_recv(rb, fd, MSG_DONTWAIT);
+        if (ret != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return ret;
+        if (wait == RR_WAIT_POLL)
+            rr_wait_poll(fd, POLLIN);
+    }
+}
+
+// user + system CPU time of @who (RUSAGE_SELF or RUSAGE_THREAD), in seconds
+static double
+rr_cpu_secs(int who) {
+    struct rusage ru;
+    if (getrusage(who, &ru) == -1)
+        die_perr("getrusage");
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+}
+
+static void
+report_percentiles(const char *name, struct hist *h) {
+    static const double pcts[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+    printf("%s: count:%lu", name, h->count);
+    for (size_t i=0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+        uint64_t t = hist_percentile(h, pcts[i]);
+        printf(" p%g:%lu (%lf usecs)", pcts[i], t, __tsc_getusecs(t));
+    }
+    printf(" max:%lu (%lf usecs)\n", h->max, __tsc_getusecs(h->max));
+}
+
+/**
+ * Kernel timestamps
+ *
+ * With SO_TIMESTAMPING, the kernel stamps when a message was handed to the
+ * device (TX) and when it arrived from it (RX), in software or, if the NIC
+ * supports it, in hardware. Together with the user-space send and receive
+ * times, this splits the time of a message into the sender's stack, the
+ * network (for the client: including the server), and the receiver's stack
+ * and scheduling. Software timestamps are in CLOCK_REALTIME, so user-space
+ * times for these splits are taken with rr_realtime_ns() and intervals are
+ * converted to ticks for recording.
+ */
+
+enum rr_kts {
+    RR_KTS_NONE = 0,
+    RR_KTS_SW,
+    RR_KTS_HW, // hardware, if available, and software
+};
+
+static enum rr_kts
+rr_kts_parse(const char *str) {
+    if (strcmp(str, "sw") == 0)
+        return RR_KTS_SW;
+    else if (strcmp(str, "hw") == 0)
+        return RR_KTS_HW;
+    die("unknown kernel timestamps: %s (sw or hw)\n", str);
+    abort();
+}
+
+// enable kernel timestamps on @fd
+static void
+rr_kts_enable(int fd, enum rr_kts kts) {
+    static bool warned = false;
+
+    int ret = sock_tstamp_enable(fd, kts == RR_KTS_HW);
+    if (ret == -1)
+        die("cannot enable kernel timestamps\n");
+    if (kts == RR_KTS_HW && ret == 0 && !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED))
+        fprintf(stderr, "hardware timestamps not available: using software timestamps\n");
+}
+
+static inline uint64_t
+rr_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// @a - @b nsecs, in ticks (0 if negative, e.g., because of clock adjustments)
+static inline uint64_t
+rr_ns_diff_ticks(uint64_t a, uint64_t b) {
+    return a > b ? (uint64_t)((double)(a - b)*(double)getKhz()/1e6) : 0;
+}
+
+// TX timestamp keys are 32-bit byte offsets. Returns the 64-bit offset of
+// @key, given that @last is the offset of the last byte sent so far.
+static inline uint64_t
+rr_kts_key64(uint32_t key, uint64_t last) {
+    return last - (uint32_t)((uint32_t)last - key);
+}
+
+static enum tsc_clock
+rr_clock_parse(const char *str) {
+    if (strcmp(str, "auto") == 0)
+        return TSC_CLOCK_AUTO;
+    else if (strcmp(str, "tsc") == 0)
+        return TSC_CLOCK_CPU;
+    else if (strcmp(str, "clock") == 0)
+        return TSC_CLOCK_MONOTONIC;
+    die("unknown clock: %s\n", str);
+    abort();
+}
+
+/**
+ * Zero-copy sends (MSG_ZEROCOPY)
+ *
+ * The kernel might still read the data of a MSG_ZEROCOPY send() after it
+ * returns, until it reports the send as completed in the error queue. Hence,
+ * data is sent from a pool of rotating buffers: each buffer counts its sends
+ * that are not yet completed, and it is only written again when there are
+ * none.
+ *
+ * Sends get consecutive ids (see net_helpers.h), so we remember the buffer of
+ * each of the last RR_ZC_MAX_SENDS sends, and never have more in flight.
+ */
+
+#define RR_ZC_NBUFS     8
+#define RR_ZC_MAX_SENDS 1024
+
+struct rr_zc {
+    int fd;
+    char *bufs[RR_ZC_NBUFS];
+    unsigned pending[RR_ZC_NBUFS];    // sends not completed, per buffer
+    uint8_t send_buf[RR_ZC_MAX_SENDS]; // buffer of each send, by id
+    uint32_t next_id, done_id;         // next send id, and all before done_id completed
+    unsigned cur;                      // buffer we send from
+    size_t nsends, ncopied;            // completed sends, and how many were copied
+};
+
+static struct rr_zc *
+rr_zc_init(int fd, size_t buf_size) {
+    struct rr_zc *zc = xcalloc(1, sizeof(*zc));
+
+    if (sock_zerocopy_enable(fd) == -1)
+        die("SO_ZEROCOPY failed\n");
+    zc->fd = fd;
+    for (unsigned i=0; i < RR_ZC_NBUFS; i++)
+        zc->bufs[i] = xcalloc(1, buf_size);
+    return zc;
+}
+
+// reap completions from the error queue. If @block is set, wait until at
+// least one send completes (there must be sends in flight).
+static void
+rr_zc_reap(struct rr_zc *zc, bool block) {
+    uint32_t lo, hi;
+    bool copied;
+    int ret;
+
+    for (;;) {
+        bool reaped = false;
+        while ((ret = sock_zerocopy_read(zc->fd, &lo, &hi, &copied)) == 1) {
+            // ranges are reported in order, but might be merged
+            for (uint32_t id = lo; id != hi + 1; id++) {
+                zc->pending[zc->send_buf[id % RR_ZC_MAX_SENDS]]--;
+                zc->nsends++;
+                zc->ncopied += copied;
+            }
+            zc->done_id = hi + 1;
+            reaped = true;
+        }
+        if (ret == -1)
+            die_perr("recvmsg(MSG_ERRQUEUE)");
+        if (reaped || !block)
+            return;
+
+        // POLLERR is reported when the error queue is not empty
+        struct pollfd pfd = { .fd = zc->fd, .events = 0 };
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            die_perr("poll");
+    }
+}
+
+// wait until all sends complete
+static void
+rr_zc_drain(struct rr_zc *zc) {
+    while (zc->done_id != zc->next_id)
+        rr_zc_reap(zc, true);
+}
+
+static void
+rr_zc_fini(struct rr_zc *zc) {
+    if (!zc)
+        return;
+    // the buffers might still be in use by the kernel
+    rr_zc_drain(zc);
+    for (unsigned i=0; i < RR_ZC_NBUFS; i++)
+        free(zc->bufs[i]);
+    free(zc);
+}
+
+// send @len bytes at offset @off of the current buffer
+// returns what send() returns
+static ssize_t
+rr_zc_send(struct rr_zc *zc, size_t off, size_t len, int flags) {
+    ssize_t ret;
+
+    while (zc->next_id - zc->done_id == RR_ZC_MAX_SENDS)
+        rr_zc_reap(zc, true);
+
+    for (;;) {
+        ret = send(zc->fd, zc->bufs[zc->cur] + off, len, flags | MSG_ZEROCOPY);
+        // ENOBUFS: too many pinned pages (optmem limit) until sends complete
+        if (ret == -1 && errno == ENOBUFS && zc->next_id != zc->done_id) {
+            rr_zc_reap(zc, true);
+            continue;
+        }
+        break;
+    }
+
+    if (ret > 0) {
+        zc->send_buf[zc->next_id % RR_ZC_MAX_SENDS] = zc->cur;
+        zc->pending[zc->cur]++;
+        zc->next_id++;
+    }
+    return ret;
+}
+
+// return a buffer we can write to (it becomes the current one), or NULL if
+// there is none and @block is not set. The current buffer is kept if it can
+// be written, so a buffer is only left after something was sent from it.
+static char *
+rr_zc_buf(struct rr_zc *zc, bool block) {
+    for (;;) {
+        if (zc->pending[zc->cur] == 0)
+            return zc->bufs[zc->cur];
+        rr_zc_reap(zc, false);
+        for (unsigned i=1; i <= RR_ZC_NBUFS; i++) {
+            unsigned b = (zc->cur + i) % RR_ZC_NBUFS;
+            if (zc->pending[b] == 0) {
+                zc->cur = b;
+                return zc->bufs[b];
+            }
+        }
+        if (!block)
+            return NULL;
+        rr_zc_reap(zc, true);
+    }
+}
+
+/**
+ * Service time model
+ *
+ * The client specifies a service time distribution (-D), and passes it to
+ * the server with the RR_OPT_SVC_TIME HELO option. The server draws a service
+ * time for each request, and spins on the TSC (or sleeps) for that long
+ * before responding. Empirical CDFs are read from a file with one
+ * "<usecs> <cumulative probability>" pair per line.
+ */
+
+#define RR_PPM 1000000
+
+// largest HELO: header, and the payloads of all options
+#define RR_HELO_MAX_SIZE \
+    (sizeof(struct rr_hdr) + sizeof(struct rr_opt_svc) + RR_SVC_MAX_POINTS*sizeof(struct rr_svc_point) + \
+     sizeof(struct rr_opt_v2))
+
+// Options with a payload (in the order of their bits) follow the HELO header.
+// Returns the payload of option @opt in @helo (which has the first @have
+// bytes), or NULL if it is not there. If @size is not NULL, it is set to the
+// size of the HELO, or to a larger size than @have if more bytes are needed
+// to know it.
+static void *
+rr_helo_opt(char *helo, size_t have, unsigned opt, size_t *size) {
+    struct rr_hdr *hdr = (struct rr_hdr *)helo;
+    size_t off = sizeof(*hdr);
+    void *ret = NULL;
+
+    if (have < off)
+        goto end;
+
+    if (hdr->rrid & RR_OPT_SVC_TIME) {
+        struct rr_opt_svc *svc = (struct rr_opt_svc *)(helo + off);
+        if (opt == RR_OPT_SVC_TIME && have >= off + sizeof(*svc))
+            ret = svc;
+        off += sizeof(*svc);
+        if (have < off)
+            goto end;
+        if (svc->dist == RR_SVC_CDF)
+            off += MIN(svc->npoints, RR_SVC_MAX_POINTS)*sizeof(struct rr_svc_point);
+    }
+
+    if (hdr->rrid & RR_OPT_V2) {
+        if (opt == RR_OPT_V2 && have >= off + sizeof(struct rr_opt_v2))
+            ret = helo + off;
+        off += sizeof(struct rr_opt_v2);
+    }
+
+end:
+    if (size)
+        *size = off;
+    return ret;
+}
+
+static void
+rr_svc_parse_cdf(const char *fname, struct rr_opt_svc *svc, struct rr_svc_point **points) {
+    FILE *f = fopen(fname, "r");
+    if (!f)
+        die_perr("fopen");
+
+    char line[256];
+    unsigned n = 0, lineno = 0;
+    *points = xcalloc(RR_SVC_MAX_POINTS, sizeof(**points));
+    while (fgets(line, sizeof(line), f)) {
+        double usecs, p;
+        lineno++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (sscanf(line, "%lf %lf", &usecs, &p) != 2 || usecs < 0 || p < 0 || p > 1)
+            die("%s:%u: expecting <usecs> <cumulative probability>\n", fname, lineno);
+        if (n == RR_SVC_MAX_POINTS)
+            die("%s: more than %u points\n", fname, RR_SVC_MAX_POINTS);
+
+        struct rr_svc_point *pt = &(*points)[n];
+        pt->ns = (u64)(usecs*1000.0);
+        pt->ppm = (u32)(p*RR_PPM + 0.5);
+        if (n > 0 && (pt->ns < pt[-1].ns || pt->ppm < pt[-1].ppm))
+            die("%s:%u: points are not sorted\n", fname, lineno);
+        n++;
+    }
+    fclose(f);
+
+    if (n == 0 || (*points)[n-1].ppm != RR_PPM)
+        die("%s: the last point should have a cumulative probability of 1\n", fname);
+    svc->npoints = n;
+}
+
+// -D argument: fixed:<usecs>, exp:<mean usecs>, bimodal:<usecs>:<usecs>:<p>
+// (p: probability of the second mode), or cdf:<file>. *@points is set for
+// cdf.
+static void
+rr_svc_parse(const char *str, struct rr_opt_svc *svc, struct rr_svc_point **points) {
+    double a, b, p;
+
+    memset(svc, 0, sizeof(*svc));
+    *points = NULL;
+    if (sscanf(str, "fixed:%lf", &a) == 1 && a >= 0) {
+        svc->dist = RR_SVC_FIXED;
+        svc->ns[0] = (u64)(a*1000.0);
+    } else if (sscanf(str, "exp:%lf", &a) == 1 && a >= 0) {
+        svc->dist = RR_SVC_EXP;
+        svc->ns[0] = (u64)(a*1000.0);
+    } else if (sscanf(str, "bimodal:%lf:%lf:%lf", &a, &b, &p) == 3 && a >= 0 && b >= 0 && p >= 0 && p <= 1) {
+        svc->dist = RR_SVC_BIMODAL;
+        svc->ns[0] = (u64)(a*1000.0);
+        svc->ns[1] = (u64)(b*1000.0);
+        svc->ppm = (u32)(p*RR_PPM + 0.5);
+    } else if (strncmp(str, "cdf:", 4) == 0) {
+        svc->dist = RR_SVC_CDF;
+        rr_svc_parse_cdf(str + 4, svc, points);
+    } else {
+        die("invalid service time distribution: %s\n", str);
+    }
+}
+
+static void
+rr_svc_print(FILE *f, const char *prefix, const struct rr_opt_svc *svc, const struct rr_svc_point *points) {
+    const char *how = svc->sleep ? "sleep" : "spin";
+    switch (svc->dist) {
+        case RR_SVC_NONE:
+        return;
+
+        case RR_SVC_FIXED:
+        fprintf(f, "%sservice time: fixed %.3f usecs (%s)\n", prefix, svc->ns[0]/1000.0, how);
+        return;
+
+        case RR_SVC_EXP:
+        fprintf(f, "%sservice time: exponential mean:%.3f usecs (%s)\n", prefix, svc->ns[0]/1000.0, how);
+        return;
+
+        case RR_SVC_BIMODAL:
+        fprintf(f, "%sservice time: bimodal %.3f usecs, or %.3f usecs with p=%.6f (%s)\n", prefix,
+                svc->ns[0]/1000.0, svc->ns[1]/1000.0, (double)svc->ppm/RR_PPM, how);
+        return;
+
+        case RR_SVC_CDF:
+        fprintf(f, "%sservice time: empirical CDF of %u points, %.3f to %.3f usecs (%s)\n", prefix,
+                svc->npoints, points[0].ns/1000.0, points[svc->npoints-1].ns/1000.0, how);
+        return;
+    }
+}
+
 /**
  * Server
  */
 
+// max requests read (and responses sent) with a single syscall
+#define SRV_MAX_BATCH 64
+
+// per-connection service time model (see struct rr_opt_svc)
+struct srv_svc {
+    struct rr_opt_svc opt;
+    struct rr_svc_point *points;
+    unsigned short xsubi[3];
+};
+
+static void
+srv_svc_init(struct srv_svc *svc, const struct rr_opt_svc *opt, const struct rr_svc_point *points) {
+    svc->opt = *opt;
+    svc->points = NULL;
+    if (opt->dist == RR_SVC_CDF) {
+        svc->points = xmalloc(opt->npoints*sizeof(*points));
+        memcpy(svc->points, points, opt->npoints*sizeof(*points));
+    }
+    uint64_t t = get_ticks();
+    svc->xsubi[0] = t;
+    svc->xsubi[1] = t >> 16;
+    svc->xsubi[2] = getpid();
+}
+
 static void
-srv_serve(struct url *cli_url, int fd) {
+srv_svc_fini(struct srv_svc *svc) {
+    free(svc->points);
+}
+
+// draw a service time, in nsecs
+static uint64_t
+srv_svc_sample(struct srv_svc *svc) {
+    const struct rr_opt_svc *o = &svc->opt;
+
+    switch (o->dist) {
+        case RR_SVC_NONE:
+        return 0;
+
+        case RR_SVC_FIXED:
+        return o->ns[0];
+
+        case RR_SVC_EXP:
+        return (uint64_t)(-log(1.0 - erand48(svc->xsubi)) * (double)o->ns[0]);
+
+        case RR_SVC_BIMODAL:
+        return erand48(svc->xsubi)*RR_PPM < o->ppm ? o->ns[1] : o->ns[0];
+
+        case RR_SVC_CDF: {
+        // inverse transform: find the first point with a cumulative
+        // probability >= u, and interpolate linearly with the previous one
+        double u = erand48(svc->xsubi)*RR_PPM;
+        const struct rr_svc_point *pts = svc->points;
+        unsigned lo = 0, hi = o->npoints - 1;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (pts[mid].ppm < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0 || pts[lo].ppm == pts[lo-1].ppm)
+            return pts[lo].ns;
+        double f = (u - pts[lo-1].ppm) / (double)(pts[lo].ppm - pts[lo-1].ppm);
+        return pts[lo-1].ns + (uint64_t)(f*(double)(pts[lo].ns - pts[lo-1].ns));
+        }
+    }
+    abort();
+}
+
+// spend a service time: spin on the TSC, or sleep (which overshoots by the
+// timer slack and the wakeup latency)
+static void
+srv_svc_spend(struct srv_svc *svc) {
+    uint64_t ns = srv_svc_sample(svc);
+    if (ns == 0)
+        return;
+
+    if (svc->opt.sleep) {
+        struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+            ;
+    } else {
+        tsc_spinticks(ns*getKhz() / 1000000);
+    }
+}
+
+// make sure that the first @need bytes of the HELO are in @buf, which has
+// @have of them. Returns the bytes that @buf has.
+static size_t
+srv_helo_recv(int fd, char *buf, size_t have, size_t need) {
+    if (have >= need)
+        return have;
+    if (rr_recv(fd, buf + have, need - have, MSG_WAITALL) != (ssize_t)(need - have))
+        die_perr("recv");
+    return need;
+}
 
-    struct rr_hdr rr_msg;
+// HELO/OHHI exchange: returns the sizes requested by the client, and the
+// options (out of @supported) that were acknowledged. If RR_OPT_SVC_TIME is
+// acknowledged, @svc is initialized. If RR_OPT_V2 is, PING/PONGs use struct
+// rr_hdr2. The first @pre_len bytes of the HELO, if any, are in @pre.
+static unsigned
+srv_helo(struct url *cli_url, int fd, unsigned *req_size, unsigned *res_size,
+         unsigned supported, struct srv_svc *svc, const char *pre, size_t pre_len) {
+
+    struct {
+        struct rr_hdr hdr;
+        struct rr_opt_tstamps tstamps;
+    } __attribute__((packed)) rr_msg;
+    size_t ohhi_size = sizeof(rr_msg.hdr);
     int nreceived, nsent;
-    struct rr_hdr *req, *res;
-    unsigned req_buff_size, res_buff_size;
-    size_t count;
+    size_t have;
+    char *helo = xmalloc(RR_HELO_MAX_SIZE);
+    struct rr_hdr *hdr = (struct rr_hdr *)helo;
+    struct rr_opt_svc *svc_opt;
+    struct rr_opt_v2 *v2_opt;
+    size_t helo_size = sizeof(*hdr);
+
+    if (pre_len > 0) {
+        // the start of the HELO was already read
+        if (pre_len > RR_HELO_MAX_SIZE)
+            die("invalid protocol");
+        memcpy(helo, pre, pre_len);
+        nreceived = pre_len;
+    } else {
+        // NB: try to read the whole HELO with a single recv(), because on
+        // SOCK_SEQPACKET sockets the rest of the record would be discarded
+        nreceived = rr_recv(fd, helo, RR_HELO_MAX_SIZE, 0);
+        if (nreceived <= 0)
+            die_perr("recv");
+    }
+	have = srv_helo_recv(fd, helo, nreceived, helo_size);
+
+    if (hdr->magic != RR_MAGIC || hdr->type != RR_TYPE_HELO)
+        die("invalid protocol");
+
+    // options with a payload are read even if they are not supported
+    for (;;) {
+        rr_helo_opt(helo, have, 0, &helo_size);
+        if (helo_size <= have)
+            break;
+        have = srv_helo_recv(fd, helo, have, helo_size);
+    }
+
+    svc_opt = rr_helo_opt(helo, have, RR_OPT_SVC_TIME, NULL);
+    if (svc_opt && svc_opt->dist == RR_SVC_CDF && (svc_opt->npoints == 0 || svc_opt->npoints > RR_SVC_MAX_POINTS))
+        die("invalid protocol");
+    if (svc_opt && svc_opt->dist > RR_SVC_CDF)
+        supported &= ~RR_OPT_SVC_TIME;
+
+    rr_msg.hdr = *hdr;
+    *req_size = rr_msg.hdr.helo.req_size;
+    *res_size = rr_msg.hdr.helo.res_size;
+    unsigned opts = rr_msg.hdr.rrid & supported;
+    if (opts & RR_OPT_V2) {
+        v2_opt = rr_helo_opt(helo, have, RR_OPT_V2, NULL);
+        *req_size = v2_opt->req_size;
+        *res_size = v2_opt->res_size;
+    }
+    printf("%s//%s:%s: req_size:%u res_size:%u%s%s\n", cli_url->prot, cli_url->node, cli_url->serv, *req_size, *res_size,
+           (opts & RR_OPT_V2) ? " (v2)" : "", (opts & RR_OPT_SRV_TSTAMPS) ? " (timestamps)" : "");
+    if (opts & RR_OPT_SVC_TIME) {
+        struct rr_svc_point *points = (struct rr_svc_point *)(svc_opt + 1);
+        srv_svc_init(svc, svc_opt, points);
+        rr_svc_print(stdout, "    ", svc_opt, points);
+    }
+    free(helo);
+
+    rr_msg.hdr.type = RR_TYPE_OHHI;
+    rr_msg.hdr.rrid = opts | RR_OPT_ACK;
+    if (opts & RR_OPT_SRV_TSTAMPS) {
+        rr_msg.tstamps.khz = getKhz();
+        ohhi_size += sizeof(rr_msg.tstamps);
+    }
+    nsent = rr_send(fd, &rr_msg, ohhi_size, 0);
+	if (nsent != (int)ohhi_size)
+	    die_perr("sent");
+
+    return opts;
+}
+
+// server kernel timestamps: TX timestamps are matched with sends by the
+// offset of the last byte of each send
+#define SRV_KTS_NSENDS 64
+
+struct srv_kts {
+    struct hist *tx, *rx;
+    uint64_t last;   // offset of the last byte sent
+    struct {
+        uint64_t last, ns;
+    } sends[SRV_KTS_NSENDS]; // pending sends, [head, tail)
+    size_t head, tail;
+};
+
+static void
+srv_kts_init(struct srv_kts *k) {
+    k->tx = xmalloc(sizeof(struct hist));
+    hist_init(k->tx);
+    k->rx = xmalloc(sizeof(struct hist));
+    hist_init(k->rx);
+    k->last = (uint64_t)-1;
+    k->head = k->tail = 0;
+}
+
+static void
+srv_kts_fini(struct srv_kts *k) {
+    free(k->tx);
+    free(k->rx);
+}
+
+// record a send of @len bytes, about to start at @ns
+static void
+srv_kts_send(struct srv_kts *k, size_t len, uint64_t ns) {
+    k->last += len;
+    if (k->tail - k->head == SRV_KTS_NSENDS)
+        k->head++; // drop the oldest
+    k->sends[k->tail % SRV_KTS_NSENDS].last = k->last;
+    k->sends[k->tail % SRV_KTS_NSENDS].ns = ns;
+    k->tail++;
+}
+
+// match TX timestamps in the error queue with sends
+static void
+srv_kts_read_tx(struct srv_kts *k, int fd) {
+    struct sock_tstamp ts;
+    uint32_t key;
+    int ret;
+
+    while ((ret = sock_tstamp_read_tx(fd, &key, &ts)) == 1) {
+        if (!ts.sw)
+            continue;
+        uint64_t off = rr_kts_key64(key, k->last);
+        for (; k->head < k->tail; k->head++) {
+            uint64_t last = k->sends[k->head % SRV_KTS_NSENDS].last;
+            if (last > off)
+                break; // a partial send
+            if (last == off)
+                hist_add(k->tx, rr_ns_diff_ticks(ts.sw, k->sends[k->head % SRV_KTS_NSENDS].ns));
+        }
+    }
+    if (ret == -1)
+        die_perr("recvmsg(MSG_ERRQUEUE)");
+}
+
+// how the server sends responses: with MSG_ZEROCOPY from a pool of buffers
+// (->zc), or with their headers from the response buffer and the rest of
+// each response from a file (->file_fd, with sendfile())
+struct srv_tx {
+    struct rr_zc *zc;
+    int file_fd;
+    off_t file_size, file_off;
+    size_t hdr_len; // bytes of each response sent from the buffer
+};
+
+// send the responses in @res, with the rest of each one from the file
+static void
+srv_send_file(int fd, struct srv_tx *tx, char *res, size_t len, size_t res_buff_size) {
+    for (size_t off = 0; off < len; off += res_buff_size) {
+        for (size_t hoff = 0; hoff < tx->hdr_len;) {
+            ssize_t nsent = send(fd, res + off + hoff, tx->hdr_len - hoff, MSG_MORE);
+            if (nsent == -1)
+                die_perr("send");
+            hoff += nsent;
+        }
+        for (size_t rem = res_buff_size - tx->hdr_len; rem > 0;) {
+            if (tx->file_off == tx->file_size)
+                tx->file_off = 0;
+            size_t n = MIN(rem, (size_t)(tx->file_size - tx->file_off));
+            ssize_t nsent = sendfile(fd, tx->file_fd, &tx->file_off, n);
+            if (nsent == -1)
+                die_perr("sendfile");
+            else if (nsent == 0)
+                die("sendfile: file truncated\n");
+            rem -= nsent;
+        }
+    }
+}
+
+// send @len bytes of responses (each of @res_buff_size bytes) in @res. If @rx
+// is set, the server timestamps of the responses are filled in.
+//
+// returns the buffer for the next responses, which is @res unless we send
+// with MSG_ZEROCOPY.
+static char *
+srv_send(int fd, struct srv_tx *stx, bool v2, char *res, size_t len, size_t res_buff_size, uint64_t rx, struct srv_kts *kst) {
+    if (len == 0)
+        return res;
+
+    if (rx) {
+        uint64_t tx = get_ticks();
+        for (size_t off = 0; off < len; off += res_buff_size) {
+            struct rr_srv_tstamps *ts = rr_msg_data(v2, res + off);
+            ts->rx = rx;
+            ts->tx = tx;
+        }
+    }
+
+    if (kst)
+        srv_kts_send(kst, len, rr_realtime_ns());
+    if (stx->file_fd >= 0) {
+        srv_send_file(fd, stx, res, len, res_buff_size);
+        return res;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t nsent = stx->zc ? rr_zc_send(stx->zc, off, len - off, 0)
+                                : rr_send(fd, res + off, len - off, 0);
+        if (nsent == -1)
+            die_perr("send");
+        off += nsent;
+    }
+    return stx->zc ? rr_zc_buf(stx->zc, true) : res;
+}
+
+// rate (messages/sec) of @count messages served since @t_first (ticks of the
+// first one)
+static double
+srv_msgs_rate(size_t count, uint64_t t_first) {
+    double secs = count ? __tsc_getsecs(get_ticks() - t_first) : 0;
+    return secs > 0 ? count / secs : 0;
+}
+
+static void
+srv_serve(struct url *cli_url, int fd, enum rr_wait wait, enum rr_kts kts, bool zerocopy, int file_fd) {
+
+    ssize_t nreceived;
+    void *req;
+    char *res;
+    struct rr_rbuf rb;
+    unsigned req_size, res_size, opts;
+    size_t req_buff_size, res_buff_size, res_cap, res_len;
+    size_t count = 0, zc_sends = 0, zc_copied = 0;
+    uint64_t t_first = 0;
+    double cpu = rr_cpu_secs(RUSAGE_THREAD);
+    bool tstamps, v2;
+    struct srv_kts kst;
+    struct sock_tstamp rxts;
+    // the start of a HELO that renegotiates the connection (RR_OPT_SWEEP),
+    // if it was read together with requests
+    char *helo = NULL;
+    size_t helo_len = 0;
+    // renegotiating would break the byte offsets of TX timestamp keys
+    const unsigned supported = RR_OPT_SRV_TSTAMPS | RR_OPT_SVC_TIME | RR_OPT_V2 | (kts ? 0 : RR_OPT_SWEEP);
+
+    printf("connection from: %s//%s:%s\n", cli_url->prot, cli_url->node, cli_url->serv);
+    rr_wait_setup(fd, wait);
+
+    // each iteration serves the requests after a HELO, until the connection
+    // is closed, or the client sends another HELO
+    for (bool first = true; ; first = false) {
+        struct srv_svc svc = {0};
+        struct srv_tx tx = { .file_fd = file_fd };
+
+        opts = srv_helo(cli_url, fd, &req_size, &res_size, supported, &svc, helo, helo_len);
+        tstamps = opts & RR_OPT_SRV_TSTAMPS;
+        v2 = opts & RR_OPT_V2;
+        free(helo);
+        helo = NULL;
+        helo_len = 0;
+
+        // after the HELO exchange, so that TX keys start at the first
+        // response (OPT_ID_TCP: even if the OHHI is not acked yet)
+        if (kts && first) {
+            rr_kts_enable(fd, kts);
+            srv_kts_init(&kst);
+        }
+
+        req_buff_size = rr_msg_size(v2, req_size);
+        rr_rbuf_init(&rb, rr_buff_cap(req_buff_size, SRV_MAX_BATCH));
+
+        // responses to all the requests of a single recv() are sent together
+        // (as long as they fit in the buffer)
+        res_buff_size = rr_msg_size(v2, res_size + (tstamps ? sizeof(struct rr_srv_tstamps) : 0));
+        res_cap = rr_buff_cap(res_buff_size, rb.cap / req_buff_size);
+        res = NULL;
+        if (zerocopy)
+            tx.zc = rr_zc_init(fd, res_cap);
+        for (unsigned i=0; i < (zerocopy ? RR_ZC_NBUFS : 1); i++) {
+            res = zerocopy ? tx.zc->bufs[i] : xcalloc(1, res_cap);
+            for (size_t off=0; off < res_cap; off += res_buff_size) {
+                rr_msg_init(v2, res + off, RR_TYPE_PONG, 0, res_size);
+                if (v2 && tstamps)
+                    ((struct rr_hdr2 *)(res + off))->flags |= RR_HDR2_F_SRV_TSTAMPS;
+            }
+        }
+        if (zerocopy)
+            res = rr_zc_buf(tx.zc, true);
+
+        if (file_fd >= 0) {
+            struct stat st;
+            if (fstat(file_fd, &st) == -1)
+                die_perr("fstat");
+            tx.file_size = st.st_size;
+            tx.hdr_len = (char *)rr_msg_data(v2, res) - res + (tstamps ? sizeof(struct rr_srv_tstamps) : 0);
+        }
+
+        while (!helo) {
+            if (kts) {
+                srv_kts_read_tx(&kst, fd);
+                nreceived = rr_rbuf_recv_tstamp(&rb, fd, rr_wait_blocks(wait) ? 0 : MSG_DONTWAIT, &rxts);
+                if (nreceived == -1 && !rr_wait_blocks(wait) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (wait == RR_WAIT_POLL)
+                        rr_wait_poll(fd, POLLIN);
+                    continue;
+                }
+                if (nreceived > 0 && rxts.sw)
+                    hist_add(kst.rx, rr_ns_diff_ticks(rr_realtime_ns(), rxts.sw));
+            } else {
+                nreceived = rr_rbuf_recv_wait(&rb, fd, wait);
+            }
+            if (nreceived == -1)
+                die_perr("recv");
+            else if (nreceived == 0)
+                break;
+
+            // all the requests of the batch completed with this recv()
+            uint64_t rx = tstamps ? get_ticks() : 0;
+
+            res_len = 0;
+            for (;;) {
+                // the client only sends a HELO (which always has a v1 header)
+                // when all of its requests are answered, so it is the last
+                // thing in the buffer
+                req = rr_rbuf_peek(&rb, sizeof(struct rr_hdr));
+                if ((opts & RR_OPT_SWEEP) && req && rr_msg_is(false, req, RR_TYPE_HELO)) {
+                    helo_len = rb.end - rb.start;
+                    helo = xmalloc(helo_len);
+                    memcpy(helo, req, helo_len);
+                    break;
+                }
+                if ((req = rr_rbuf_next(&rb, req_buff_size)) == NULL)
+                    break;
+                if (!rr_msg_is(v2, req, RR_TYPE_PING))
+                    die("invalid protocol");
+
+                if (res_len == res_cap) {
+                    res = srv_send(fd, &tx, v2, res, res_len, res_buff_size, tstamps ? rx : 0, kts ? &kst : NULL);
+                    res_len = 0;
+                }
+                rr_msg_reply(v2, res + res_len, req);
+                res_len += res_buff_size;
+                if (count++ == 0)
+                    t_first = get_ticks();
+
+                // with a service time, each response is sent as soon as its
+                // request is served, so requests queue behind each other (but
+                // not behind the rest of the batch)
+                if (svc.opt.dist) {
+                    srv_svc_spend(&svc);
+                    res = srv_send(fd, &tx, v2, res, res_len, res_buff_size, tstamps ? rx : 0, kts ? &kst : NULL);
+                    res_len = 0;
+                }
+            }
+
+            res = srv_send(fd, &tx, v2, res, res_len, res_buff_size, tstamps ? rx : 0, kts ? &kst : NULL);
+        }
+
+        if (tx.zc) {
+            rr_zc_drain(tx.zc);
+            zc_sends += tx.zc->nsends;
+            zc_copied += tx.zc->ncopied;
+            rr_zc_fini(tx.zc);
+        } else {
+            free(res);
+        }
+        rr_rbuf_fini(&rb);
+        srv_svc_fini(&svc);
+        if (!helo)
+            break;
+    }
+
+    cpu = rr_cpu_secs(RUSAGE_THREAD) - cpu;
+    printf("done with: %s//%s:%s (served %zd messages, %.1f msgs/sec, cpu: %.3f secs)\n",
+           cli_url->prot, cli_url->node, cli_url->serv, count, srv_msgs_rate(count, t_first), cpu);
+    if (kts) {
+        // RX: kernel RX timestamp to recv() return, TX: send() to kernel TX
+        // timestamp, for each recv() and send() respectively
+        srv_kts_read_tx(&kst, fd);
+        report_percentiles("KERNEL-RX", kst.rx);
+        report_percentiles("KERNEL-TX", kst.tx);
+        srv_kts_fini(&kst);
+    }
+    if (zerocopy)
+        printf("ZEROCOPY: sends:%zd copied:%zd\n", zc_sends, zc_copied);
+    rr_shm_close(fd);
+    close(fd);
+}
+
+/**
+ * io_uring transport
+ */
+
+#define URING_ENTRIES 64
+
+// user_data values of the operations we submit
+enum {
+    URING_UD_RECV = 1,
+    URING_UD_SEND = 2,
+};
+
+static void
+rr_uring_init(struct uring *ring, bool sqpoll) {
+    int err = uring_init(ring, URING_ENTRIES, sqpoll ? IORING_SETUP_SQPOLL : 0);
+    if (err < 0)
+        die("uring_init: %s\n", strerror(-err));
+}
+
+static struct io_uring_sqe *
+rr_uring_sqe(struct uring *ring) {
+    struct io_uring_sqe *sqe;
+    while ((sqe = uring_get_sqe(ring)) == NULL) {
+        int err = uring_submit(ring);
+        if (err < 0)
+            die("io_uring_enter: %s\n", strerror(-err));
+    }
+    return sqe;
+}
+
+static void
+rr_uring_prep_fixed(struct uring *ring, uint8_t op, int fd, const void *buf,
+                    size_t len, unsigned buf_index, uint64_t user_data) {
+    struct io_uring_sqe *sqe = rr_uring_sqe(ring);
+    uring_sqe_prep(sqe, op, fd, buf, len, user_data);
+    sqe->buf_index = buf_index;
+}
+
+// wait for a completion, and return its user_data, res, and flags
+static uint64_t
+rr_uring_wait(struct uring *ring, int *res, unsigned *flags) {
+    struct io_uring_cqe *cqe = uring_wait_cqe(ring);
+    if (!cqe)
+        die_perr("io_uring_enter");
+
+    uint64_t ud = cqe->user_data;
+    *res = cqe->res;
+    *flags = cqe->flags;
+    uring_cqe_seen(ring);
+    return ud;
+}
+
+#define SRV_URING_NBUFS 64 // provided buffers for multishot recv
+#define SRV_URING_BGID  0
+
+// Responses are sent in batches: one batch is in flight while the next one is
+// being filled. Only one send is in flight at any time, so that the stream is
+// never reordered. Both batches are registered buffers (of a sparse table,
+// because they grow).
+struct srv_uring_batch {
+    char *buf;
+    size_t len, cap;
+};
+
+static void
+srv_uring_batch_reserve(struct uring *ring, struct srv_uring_batch *b,
+                        unsigned idx, size_t len) {
+    if (len <= b->cap)
+        return;
+
+    b->cap = MAX(2*b->cap, len);
+    b->buf = xrealloc(b->buf, b->cap);
+    struct iovec iov = { .iov_base = b->buf, .iov_len = b->cap };
+    int err = uring_update_buffer(ring, idx, &iov);
+    if (err < 0)
+        die("uring_update_buffer: %s\n", strerror(-err));
+}
+
+static void
+srv_uring_serve(struct url *cli_url, int fd, bool sqpoll) {
+
+    unsigned req_size, res_size;
+    size_t req_buff_size, res_buff_size;
+    struct uring ring;
+    struct uring_buf_ring br;
+    struct srv_uring_batch batches[2] = {0};
+    unsigned fill = 0; // batch being filled; the other one may be in flight
+    bool send_inflight = false, recv_armed = false, eof = false;
+    size_t send_off = 0, rlen = 0, count = 0;
+    uint64_t t_first = 0;
+    char *req;
+    bool v2;
+    int err;
+
+    printf("connection from: %s//%s:%s\n", cli_url->prot, cli_url->node, cli_url->serv);
+    v2 = srv_helo(cli_url, fd, &req_size, &res_size, RR_OPT_V2, NULL, NULL, 0) & RR_OPT_V2;
+    req_buff_size = rr_msg_size(v2, req_size);
+    res_buff_size = rr_msg_size(v2, res_size);
+    // requests might be split across provided buffers: reassemble them here
+    req = xmalloc(req_buff_size);
+
+    rr_uring_init(&ring, sqpoll);
+    if ((err = uring_register_buffers_sparse(&ring, 2)) < 0)
+        die("uring_register_buffers_sparse: %s\n", strerror(-err));
+    for (unsigned i=0; i < 2; i++)
+        srv_uring_batch_reserve(&ring, &batches[i], i, rr_buff_cap(res_buff_size, SRV_URING_NBUFS));
+    size_t buf_size = MAX(req_buff_size, 4096UL);
+    err = uring_buf_ring_init(&ring, &br, SRV_URING_BGID, SRV_URING_NBUFS, MIN(buf_size, (size_t)RR_BUFF_MAX));
+    if (err < 0)
+        die("uring_buf_ring_init: %s\n", strerror(-err));
+
+    for (;;) {
+        if (!recv_armed && !eof) {
+            struct io_uring_sqe *sqe = rr_uring_sqe(&ring);
+            uring_sqe_prep(sqe, IORING_OP_RECV, fd, NULL, 0, URING_UD_RECV);
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = SRV_URING_BGID;
+            recv_armed = true;
+        }
+
+        if (!send_inflight && batches[fill].len > 0) {
+            rr_uring_prep_fixed(&ring, IORING_OP_WRITE_FIXED, fd, batches[fill].buf,
+                                batches[fill].len, fill, URING_UD_SEND);
+            send_inflight = true;
+            fill ^= 1;
+        }
+
+        if (eof && !send_inflight)
+            break;
+
+        int res;
+        unsigned flags;
+        switch (rr_uring_wait(&ring, &res, &flags)) {
+            case URING_UD_RECV: {
+            if (!(flags & IORING_CQE_F_MORE))
+                recv_armed = false;
+            if (res == -ENOBUFS) // all buffers in use: re-arm
+                break;
+            if (res < 0) {
+                errno = -res;
+                die_perr("recv");
+            }
+            if (res == 0) {
+                eof = true;
+                break;
+            }
+
+            uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            const char *p = uring_buf_ring_buf(&br, bid);
+            while (res > 0) {
+                size_t n = MIN(req_buff_size - rlen, (size_t)res);
+                memcpy(req + rlen, p, n);
+                p += n;
+                res -= n;
+                rlen += n;
+                if (rlen < req_buff_size)
+                    break;
+
+                rlen = 0;
+                if (!rr_msg_is(v2, req, RR_TYPE_PING))
+                    die("invalid protocol");
+
+                struct srv_uring_batch *b = &batches[fill];
+                srv_uring_batch_reserve(&ring, b, fill, b->len + res_buff_size);
+                rr_msg_init(v2, b->buf + b->len, RR_TYPE_PONG, 0, res_size);
+                rr_msg_reply(v2, b->buf + b->len, req);
+                b->len += res_buff_size;
+                if (count++ == 0)
+                    t_first = get_ticks();
+            }
+            uring_buf_ring_recycle(&br, bid);
+            break;
+            }
+
+            case URING_UD_SEND: {
+            struct srv_uring_batch *b = &batches[fill ^ 1];
+            if (res < 0) {
+                errno = -res;
+                die_perr("send");
+            }
+            send_off += res;
+            if (send_off < b->len) {
+                rr_uring_prep_fixed(&ring, IORING_OP_WRITE_FIXED, fd, b->buf + send_off,
+                                    b->len - send_off, fill ^ 1, URING_UD_SEND);
+            } else {
+                b->len = send_off = 0;
+                send_inflight = false;
+            }
+            break;
+            }
+
+            default:
+            die("unexpected io_uring completion\n");
+        }
+    }
+
+    printf("done with: %s//%s:%s (served %zd messages, %.1f msgs/sec)\n",
+           cli_url->prot, cli_url->node, cli_url->serv, count, srv_msgs_rate(count, t_first));
+    uring_exit(&ring);
+    uring_buf_ring_free(&br);
+    for (unsigned i=0; i < 2; i++)
+        free(batches[i].buf);
+    free(req);
+    close(fd);
+}
+
+/**
+ * epoll server: each thread multiplexes any number of non-blocking connections
+ */
+
+#define SRV_EPOLL_MAX_EVENTS 64
+#define SRV_EPOLL_MAX_BATCH  64 // max batches served per connection wakeup
+
+struct srv_conn {
+    int fd;
+    struct url cli_url;
+    size_t count;
+    uint64_t t_first; // ticks when the first message was served
+    // sizes and options negotiated in the HELO exchange (valid if
+    // ->helo_done). With RR_OPT_SWEEP, the client renegotiates them with
+    // another HELO.
+    bool helo_done;
+    unsigned opts, req_size, res_size;
+    size_t req_buff_size, res_buff_size;
+    // received data: up to SRV_MAX_BATCH requests, and room for the largest
+    // HELO if one is expected
+    struct rr_rbuf rb;
+    // responses, prebuilt PONGs for a full batch of requests
+    struct rr_hdr ohhi;
+    char *res;
+    size_t res_cap;
+    // pending response(s): ->woff out of ->wlen bytes of ->wbuf are sent
+    const char *wbuf;
+    size_t wlen, woff;
+    bool epollout;
+};
+
+static struct srv_conn *
+srv_conn_alloc(int fd, struct url *cli_url) {
+    struct srv_conn *conn = xcalloc(1, sizeof(*conn));
+
+    conn->fd = fd;
+    conn->cli_url = *cli_url;
+    // NB: rr_rbuf_compact() needs room for one byte more than a full HELO
+    rr_rbuf_init(&conn->rb, RR_HELO_MAX_SIZE + 1);
+    return conn;
+}
+
+static void
+srv_conn_close(struct srv_conn *conn) {
+    struct url *u = &conn->cli_url;
+
+    printf("done with: %s//%s:%s (served %zd messages, %.1f msgs/sec)\n",
+           u->prot, u->node, u->serv, conn->count, srv_msgs_rate(conn->count, conn->t_first));
+    close(conn->fd);
+    url_free_fields(u);
+    rr_rbuf_fini(&conn->rb);
+    free(conn->res);
+    free(conn);
+}
+
+static void
+srv_conn_set_epollout(int epfd, struct srv_conn *conn, bool epollout) {
+    if (conn->epollout == epollout)
+        return;
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (epollout ? EPOLLOUT : 0),
+        .data.ptr = conn,
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1)
+        die_perr("epoll_ctl");
+    conn->epollout = epollout;
+}
+
+// try to send the pending response
+// returns 1 if it was sent, 0 if the socket is full, -1 on error
+static int
+srv_conn_flush(struct srv_conn *conn) {
+    while (conn->woff < conn->wlen) {
+        ssize_t ret = send(conn->fd, conn->wbuf + conn->woff, conn->wlen - conn->woff, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            perror("send");
+            return -1;
+        }
+        conn->woff += ret;
+    }
+    conn->wbuf = NULL;
+    conn->wlen = conn->woff = 0;
+    return 1;
+}
+
+static void
+srv_conn_set_response(struct srv_conn *conn, const void *buf, size_t len) {
+    conn->wbuf = buf;
+    conn->wlen = len;
+    conn->woff = 0;
+}
+
+// handle the HELO, which is all that ->rb holds, and queue the OHHI
+static void
+srv_conn_helo(struct srv_conn *conn) {
+    struct rr_hdr *helo = (struct rr_hdr *)(conn->rb.buf + conn->rb.start);
+    size_t helo_len = conn->rb.end - conn->rb.start;
+    struct url *u = &conn->cli_url;
+
+    // service times are not supported: a single thread serves all the
+    // connections
+    conn->opts = helo->rrid & (RR_OPT_V2 | RR_OPT_SWEEP);
+    bool v2 = conn->opts & RR_OPT_V2;
+    struct rr_opt_v2 *v2_opt = rr_helo_opt((char *)helo, helo_len, RR_OPT_V2, NULL);
+    conn->req_size = v2 ? v2_opt->req_size : helo->helo.req_size;
+    conn->res_size = v2 ? v2_opt->res_size : helo->helo.res_size;
+    printf("%s//%s:%s: req_size:%u res_size:%u%s\n", u->prot, u->node, u->serv, conn->req_size, conn->res_size,
+           v2 ? " (v2)" : "");
+
+    conn->ohhi = *helo;
+    conn->ohhi.type = RR_TYPE_OHHI;
+    conn->ohhi.rrid = conn->opts | RR_OPT_ACK;
+    srv_conn_set_response(conn, &conn->ohhi, sizeof(conn->ohhi));
+
+    // NB: invalidates helo
+    conn->req_buff_size = rr_msg_size(v2, conn->req_size);
+    conn->res_buff_size = rr_msg_size(v2, conn->res_size);
+    size_t cap = rr_buff_cap(conn->req_buff_size, SRV_MAX_BATCH);
+    if (conn->opts & RR_OPT_SWEEP)
+        cap = MAX(cap, RR_HELO_MAX_SIZE + 1);
+    rr_rbuf_fini(&conn->rb);
+    rr_rbuf_init(&conn->rb, cap);
+    conn->res_cap = rr_buff_cap(conn->res_buff_size, conn->rb.cap / conn->req_buff_size);
+    free(conn->res);
+    conn->res = xcalloc(1, conn->res_cap);
+    for (size_t off = 0; off < conn->res_cap; off += conn->res_buff_size)
+        rr_msg_init(v2, conn->res + off, RR_TYPE_PONG, 0, conn->res_size);
+    conn->helo_done = true;
+}
+
+// handle the complete messages in ->rb, and queue the responses
+// returns 1 if there is a response to send, 0 if more data are needed, or -1
+// on protocol error
+static int
+srv_conn_handle(struct srv_conn *conn) {
+    struct rr_rbuf *rb = &conn->rb;
+    bool v2 = conn->opts & RR_OPT_V2;
+
+    // the client only sends another HELO (which always has a v1 header) when
+    // all of its requests are answered, so it is all that ->rb holds
+    struct rr_hdr *helo = rr_rbuf_peek(rb, sizeof(*helo));
+    if (helo && (!conn->helo_done || ((conn->opts & RR_OPT_SWEEP) && rr_msg_is(false, helo, RR_TYPE_HELO)))) {
+        if (helo->magic != RR_MAGIC || helo->type != RR_TYPE_HELO)
+            return -1;
+
+        size_t need;
+        rr_helo_opt((char *)helo, rb->end - rb->start, 0, &need);
+        if (rb->end - rb->start < need)
+            return 0;
+        // a HELO is never followed by anything before the OHHI
+        if (rb->end - rb->start > need)
+            return -1;
+        srv_conn_helo(conn);
+        return 1;
+    } else if (!conn->helo_done) {
+        return 0;
+    }
+
+    size_t res_len = 0;
+    void *req;
+    while (res_len < conn->res_cap && (req = rr_rbuf_peek(rb, sizeof(struct rr_hdr)))) {
+        if ((conn->opts & RR_OPT_SWEEP) && rr_msg_is(false, req, RR_TYPE_HELO))
+            break;
+        if ((req = rr_rbuf_next(rb, conn->req_buff_size)) == NULL)
+            break;
+        if (!rr_msg_is(v2, req, RR_TYPE_PING))
+            return -1;
+        rr_msg_reply(v2, conn->res + res_len, req);
+        res_len += conn->res_buff_size;
+    }
+    if (res_len == 0)
+        return 0;
+
+    if (conn->count == 0)
+        conn->t_first = get_ticks();
+    conn->count += res_len / conn->res_buff_size;
+    srv_conn_set_response(conn, conn->res, res_len);
+    return 1;
+}
+
+// serve the connection until it would block, or we reach the batch limit
+// returns -1 if the connection should be closed
+static int
+srv_conn_serve(int epfd, struct srv_conn *conn) {
+    for (unsigned i=0; i < SRV_EPOLL_MAX_BATCH; i++) {
+        // do not handle more requests before the previous responses are sent
+        if (conn->wbuf) {
+            int ret = srv_conn_flush(conn);
+            if (ret < 0)
+                return -1;
+            if (ret == 0) {
+                srv_conn_set_epollout(epfd, conn, true);
+                return 0;
+            }
+        }
+
+        int ret = srv_conn_handle(conn);
+        if (ret < 0) {
+            fprintf(stderr, "%s//%s:%s: invalid protocol\n", conn->cli_url.prot, conn->cli_url.node, conn->cli_url.serv);
+            return -1;
+        } else if (ret > 0) {
+            continue;
+        }
+
+        ssize_t n = rr_rbuf_recv(&conn->rb, conn->fd, 0);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recv");
+                return -1;
+            }
+            srv_conn_set_epollout(epfd, conn, false);
+            return 0;
+        } else if (n == 0) {
+            return -1;
+        }
+    }
+
+    // we stopped with pending responses, or requests that were already read,
+    // and no EPOLLIN might come for them: EPOLLOUT gets us back here
+    srv_conn_set_epollout(epfd, conn, true);
+    return 0;
+}
+
+static void
+srv_epoll_accept(int epfd, int lfd, enum rr_wait wait) {
+    for (;;) {
+        struct url cli_url;
+        struct sockaddr_storage cli_addr;
+        socklen_t cli_addr_size = sizeof(cli_addr);
+        int afd = accept4(lfd, (struct sockaddr *)&cli_addr, &cli_addr_size, SOCK_NONBLOCK);
+        if (afd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            die_perr("accept4");
+        }
+
+        if (url_from_peer(&cli_url, afd, (struct sockaddr *)&cli_addr, cli_addr_size) < 0)
+            die("url_from_peer failed");
+        printf("connection from: %s//%s:%s\n", cli_url.prot, cli_url.node, cli_url.serv);
+
+        // responses are sent in batches, and a small one (e.g., the last of
+        // a burst) must not wait for the ACK of the previous one
+        const int one = 1;
+        if (cli_addr.ss_family != AF_UNIX &&
+            setsockopt(afd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+            perror("setsockopt(TCP_NODELAY)");
+
+        rr_wait_setup(afd, wait);
+        struct srv_conn *conn = srv_conn_alloc(afd, &cli_url);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, afd, &ev) == -1)
+            die_perr("epoll_ctl");
+    }
+}
+
+// block and poll both wait in epoll_wait(), and spin polls it with a zero
+// timeout
+static void
+srv_epoll_loop(int lfd, enum rr_wait wait) {
+    struct epoll_event evs[SRV_EPOLL_MAX_EVENTS];
+    int epfd;
+
+    if ((epfd = epoll_create1(0)) == -1)
+        die_perr("epoll_create1");
+
+    if (fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK) == -1)
+        die_perr("fcntl");
+
+    // listening socket is the only one with a NULL ->data.ptr
+    struct epoll_event lev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &lev) == -1)
+        die_perr("epoll_ctl");
+
+    for (;;) {
+        int nevs = epoll_wait(epfd, evs, SRV_EPOLL_MAX_EVENTS, wait == RR_WAIT_SPIN ? 0 : -1);
+        if (nevs == -1) {
+            if (errno == EINTR)
+                continue;
+            die_perr("epoll_wait");
+        }
+
+        for (int i=0; i < nevs; i++) {
+            struct srv_conn *conn = evs[i].data.ptr;
+            if (conn == NULL) {
+                srv_epoll_accept(epfd, lfd, wait);
+                continue;
+            }
+
+            if (srv_conn_serve(epfd, conn) < 0)
+                srv_conn_close(conn); // close() also removes fd from epfd
+        }
+    }
+}
+
+/**
+ * UDP server
+ *
+ * A single (unconnected) socket serves all clients. Datagrams are received
+ * and responses are sent in batches with recvmmsg()/sendmmsg(). Each datagram
+ * carries exactly one message. The sizes negotiated in the HELO exchange are
+ * kept in a small hash table keyed by the client address. A retransmitted
+ * HELO just gets another OHHI.
+ */
+
+#define SRV_UDP_BATCH     32
+#define SRV_UDP_MAX_PEERS 4096 // power of 2
+#define RR_UDP_MAX_SIZE   65507
+
+struct srv_udp_peer {
+    bool used;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+    unsigned req_size, res_size;
+};
+
+static unsigned
+srv_udp_addr_hash(const struct sockaddr_storage *addr, socklen_t addrlen) {
+    const unsigned char *p = (const unsigned char *)addr;
+    unsigned h = 2166136261u; // FNV-1a
+    for (socklen_t i=0; i < addrlen; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// find the peer entry for @addr. If @alloc is set, and there is no entry, a
+// new one is allocated. Returns NULL if there is no (or no free) entry.
+static struct srv_udp_peer *
+srv_udp_peer_get(struct srv_udp_peer *peers, const struct sockaddr_storage *addr,
+                 socklen_t addrlen, bool alloc) {
+    unsigned h = srv_udp_addr_hash(addr, addrlen);
+    for (unsigned i=0; i < SRV_UDP_MAX_PEERS; i++) {
+        struct srv_udp_peer *p = &peers[(h + i) & (SRV_UDP_MAX_PEERS - 1)];
+        if (!p->used) {
+            if (!alloc)
+                return NULL;
+            p->used = true;
+            p->addrlen = addrlen;
+            memcpy(&p->addr, addr, addrlen);
+            return p;
+        }
+        if (p->addrlen == addrlen && memcmp(&p->addr, addr, addrlen) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+static void
+srv_udp_loop(int fd, enum rr_wait wait) {
+    struct srv_udp_peer *peers = xcalloc(SRV_UDP_MAX_PEERS, sizeof(*peers));
+    struct mmsghdr imsgs[SRV_UDP_BATCH], omsgs[SRV_UDP_BATCH];
+    struct iovec iiovs[SRV_UDP_BATCH], oiovs[SRV_UDP_BATCH][2];
+    struct sockaddr_storage addrs[SRV_UDP_BATCH];
+    struct rr_hdr ohdrs[SRV_UDP_BATCH];
+    char *ibufs = xmalloc(SRV_UDP_BATCH*RR_UDP_MAX_SIZE);
+    // response payloads are all zeroes
+    char *zeroes = xcalloc(1, RR_UDP_MAX_SIZE);
+    size_t count = 0, dropped = 0;
+
+    for (unsigned i=0; i < SRV_UDP_BATCH; i++) {
+        iiovs[i].iov_base = ibufs + i*RR_UDP_MAX_SIZE;
+        iiovs[i].iov_len = RR_UDP_MAX_SIZE;
+    }
+
+    rr_wait_setup(fd, wait);
+    const int rflags = rr_wait_blocks(wait) ? MSG_WAITFORONE : MSG_DONTWAIT;
+
+    for (;;) {
+        for (unsigned i=0; i < SRV_UDP_BATCH; i++) {
+            imsgs[i].msg_hdr = (struct msghdr) {
+                .msg_name = &addrs[i],
+                .msg_namelen = sizeof(addrs[i]),
+                .msg_iov = &iiovs[i],
+                .msg_iovlen = 1,
+            };
+        }
+
+        int n = recvmmsg(fd, imsgs, SRV_UDP_BATCH, rflags, NULL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (wait == RR_WAIT_POLL)
+                    rr_wait_poll(fd, POLLIN);
+                continue;
+            }
+            die_perr("recvmmsg");
+        }
+
+        unsigned nout = 0;
+        for (int i=0; i < n; i++) {
+            struct rr_hdr *req = iiovs[i].iov_base;
+            size_t len = imsgs[i].msg_len;
+            socklen_t addrlen = imsgs[i].msg_hdr.msg_namelen;
+            struct srv_udp_peer *peer;
+            struct rr_hdr *res = &ohdrs[nout];
+            struct iovec *iov = oiovs[nout];
+
+            if (len < sizeof(struct rr_hdr) || req->magic != RR_MAGIC) {
+                dropped++;
+                continue;
+            }
+
+            if (req->type == RR_TYPE_HELO) {
+                peer = srv_udp_peer_get(peers, &addrs[i], addrlen, true);
+                if (!peer) {
+                    fprintf(stderr, "too many UDP peers: dropping HELO\n");
+                    dropped++;
+                    continue;
+                }
+                if (peer->req_size != req->helo.req_size || peer->res_size != req->helo.res_size) {
+                    struct url u;
+                    peer->req_size = req->helo.req_size;
+                    peer->res_size = req->helo.res_size;
+                    if (url_from_peer(&u, fd, (struct sockaddr *)&addrs[i], addrlen) == 0) {
+                        printf("%s//%s:%s: req_size:%u res_size:%u\n", u.prot, u.node, u.serv, peer->req_size, peer->res_size);
+                        url_free_fields(&u);
+                    }
+                }
+                *res = *req;
+                res->type = RR_TYPE_OHHI;
+                res->rrid = RR_OPT_ACK; // no options supported
+                iov[0] = (struct iovec) { .iov_base = res, .iov_len = sizeof(*res) };
+                iov[1] = (struct iovec) { .iov_base = zeroes, .iov_len = 0 };
+            } else if (req->type == RR_TYPE_PING) {
+                peer = srv_udp_peer_get(peers, &addrs[i], addrlen, false);
+                if (!peer || len != sizeof(struct rr_hdr) + peer->req_size) {
+                    dropped++;
+                    continue;
+                }
+                rr_init_pong(res, req->rrid, peer->res_size);
+                iov[0] = (struct iovec) { .iov_base = res, .iov_len = sizeof(*res) };
+                iov[1] = (struct iovec) { .iov_base = zeroes, .iov_len = peer->res_size };
+                count++;
+            } else {
+                dropped++;
+                continue;
+            }
+
+            omsgs[nout].msg_hdr = (struct msghdr) {
+                .msg_name = &addrs[i],
+                .msg_namelen = addrlen,
+                .msg_iov = iov,
+                .msg_iovlen = 2,
+            };
+            nout++;
+        }
+
+        for (unsigned off = 0; off < nout; ) {
+            int ret = sendmmsg(fd, omsgs + off, nout - off, 0);
+            if (ret == -1) {
+                if (errno == EINTR)
+                    continue;
+                // e.g., ECONNREFUSED or ENOBUFS: the response is lost, as it
+                // would be on the wire.
+                perror("sendmmsg");
+                dropped++;
+                off++;
+                continue;
+            }
+            off += ret;
+        }
+
+        dmsg("served:%zd dropped:%zd\n", count, dropped);
+    }
+}
+
+/**
+ * AF_XDP server
+ *
+ * An XDP program redirects UDP packets to the server port from one queue of
+ * the device that has the server address to an AF_XDP socket, and PONGs are
+ * built in place (in the UMEM frame of the PING) and sent back via the TX
+ * ring. Everything else (e.g., ARP) goes to the stack as usual.
+ *
+ * Frames cycle: fill ring -> RX ring -> TX ring -> completion ring -> fill
+ * ring, or RX ring -> fill ring for dropped packets. There are as many frames
+ * as ring entries, so the rings never overflow.
+ */
+
+#define SRV_XDP_FRAMES     4096
+#define SRV_XDP_FRAME_SIZE 4096
+#define SRV_XDP_BATCH      64
+// max size of the rr message in a frame: the kernel might place the packet
+// after XDP_PACKET_HEADROOM (256) bytes
+#define SRV_XDP_MAX_RR_SIZE \
+    (SRV_XDP_FRAME_SIZE - 256 - sizeof(struct ether_header) - sizeof(struct ip6_hdr) - sizeof(struct udphdr))
+
+static uint16_t
+srv_xdp_csum_fold(uint32_t sum) {
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+static uint32_t
+srv_xdp_csum_add(uint32_t sum, const void *data, size_t len) {
+    const uint16_t *p = data;
+    for (; len > 1; len -= 2)
+        sum += *p++;
+    if (len)
+        sum += *(const uint8_t *)p;
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+// Parse an ethernet frame, and return the UDP header, or NULL if this is not
+// a UDP packet to @port (network order). The peer address is placed in @peer.
+static struct udphdr *
+srv_xdp_parse(char *pkt, size_t len, uint16_t port, struct sockaddr_storage *peer, socklen_t *peerlen) {
+    struct ether_header *eth = (struct ether_header *)pkt;
+    struct udphdr *udp;
+
+    if (len < sizeof(*eth))
+        return NULL;
+
+    if (eth->ether_type == htons(ETHERTYPE_IP)) {
+        struct iphdr *ip = (struct iphdr *)(eth + 1);
+        udp = (struct udphdr *)(ip + 1);
+        if (len < sizeof(*eth) + sizeof(*ip) + sizeof(*udp) || ip->ihl != 5 || ip->protocol != IPPROTO_UDP)
+            return NULL;
+        struct sockaddr_in *sin = (struct sockaddr_in *)peer;
+        memset(sin, 0, sizeof(*sin));
+        sin->sin_family = AF_INET;
+        sin->sin_port = udp->source;
+        sin->sin_addr.s_addr = ip->saddr;
+        *peerlen = sizeof(*sin);
+    } else if (eth->ether_type == htons(ETHERTYPE_IPV6)) {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)(eth + 1);
+        udp = (struct udphdr *)(ip6 + 1);
+        if (len < sizeof(*eth) + sizeof(*ip6) + sizeof(*udp) || ip6->ip6_nxt != IPPROTO_UDP)
+            return NULL;
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)peer;
+        memset(sin6, 0, sizeof(*sin6));
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = udp->source;
+        sin6->sin6_addr = ip6->ip6_src;
+        *peerlen = sizeof(*sin6);
+    } else {
+        return NULL;
+    }
+
+    if (udp->dest != port || ntohs(udp->len) > len - ((char *)udp - pkt))
+        return NULL;
+    return udp;
+}
+
+// Turn the frame of a parsed packet into a response with @rr_len bytes of
+// UDP payload (already in place), and return its length.
+//
+// The UDP checksum is optional for IPv4, so it is only computed for IPv6.
+static size_t
+srv_xdp_reply(char *pkt, struct udphdr *udp, size_t rr_len) {
+    struct ether_header *eth = (struct ether_header *)pkt;
+    uint8_t mac[ETH_ALEN];
+    uint16_t port;
+
+    memcpy(mac, eth->ether_shost, ETH_ALEN);
+    memcpy(eth->ether_shost, eth->ether_dhost, ETH_ALEN);
+    memcpy(eth->ether_dhost, mac, ETH_ALEN);
+
+    port = udp->source;
+    udp->source = udp->dest;
+    udp->dest = port;
+    udp->len = htons(sizeof(*udp) + rr_len);
+    udp->check = 0;
+
+    if (eth->ether_type == htons(ETHERTYPE_IP)) {
+        struct iphdr *ip = (struct iphdr *)(eth + 1);
+        uint32_t addr = ip->saddr;
+        ip->saddr = ip->daddr;
+        ip->daddr = addr;
+        ip->tot_len = htons(sizeof(*ip) + sizeof(*udp) + rr_len);
+        ip->ttl = 64;
+        ip->check = 0;
+        ip->check = srv_xdp_csum_fold(srv_xdp_csum_add(0, ip, sizeof(*ip)));
+    } else {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)(eth + 1);
+        struct in6_addr addr = ip6->ip6_src;
+        ip6->ip6_src = ip6->ip6_dst;
+        ip6->ip6_dst = addr;
+        ip6->ip6_plen = udp->len;
+        ip6->ip6_hlim = 64;
+
+        uint32_t sum = srv_xdp_csum_add(0, &ip6->ip6_src, 2*sizeof(struct in6_addr));
+        sum += udp->len + htons(IPPROTO_UDP);
+        sum = srv_xdp_csum_add(sum, udp, sizeof(*udp) + rr_len);
+        udp->check = srv_xdp_csum_fold(sum);
+        if (udp->check == 0)
+            udp->check = 0xffff;
+    }
+
+    return (char *)(udp + 1) + rr_len - pkt;
+}
+
+static void
+srv_xdp_peer_print(const struct sockaddr_storage *addr, socklen_t addrlen, struct srv_udp_peer *peer) {
+    char host[NI_MAXHOST], serv[NI_MAXSERV];
+    if (getnameinfo((struct sockaddr *)addr, addrlen, host, sizeof(host), serv, sizeof(serv),
+                    NI_NUMERICHOST|NI_NUMERICSERV) == 0)
+        printf("xdp://%s:%s: req_size:%u res_size:%u\n", host, serv, peer->req_size, peer->res_size);
+}
+
+static void
+srv_xdp_loop(struct addrinfo *ai, unsigned queue, enum rr_wait wait) {
+    struct srv_udp_peer *peers = xcalloc(SRV_UDP_MAX_PEERS, sizeof(*peers));
+    size_t count = 0, dropped = 0;
+    char ifname[IFNAMSIZ], log[4096];
+    struct xsk xsk;
+    uint16_t port;
+    int ifindex, err;
+
+    if (ai->ai_family == AF_INET)
+        port = ((struct sockaddr_in *)ai->ai_addr)->sin_port;
+    else
+        port = ((struct sockaddr_in6 *)ai->ai_addr)->sin6_port;
+
+    if (addr_ifname(ai->ai_addr, ifname) == -1)
+        die("AF_XDP: no device with the server address (a wildcard address cannot be used)\n");
+    if ((ifindex = if_nametoindex(ifname)) == 0)
+        die_perr("if_nametoindex");
+
+    if ((err = xsk_init(&xsk, ifindex, queue, SRV_XDP_FRAMES, SRV_XDP_FRAME_SIZE, SRV_XDP_FRAMES)) < 0)
+        die("AF_XDP: socket on %s queue %u failed: %s\n", ifname, queue, strerror(-err));
+    if ((err = xsk_attach_prog(&xsk, ifindex, queue, ntohs(port), log, sizeof(log))) < 0)
+        die("AF_XDP: XDP program on %s failed: %s\n%s", ifname, strerror(-err), log);
+
+    struct xdp_options opts;
+    socklen_t optlen = sizeof(opts);
+    if (getsockopt(xsk.fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen) == -1)
+        opts.flags = 0;
+    printf("AF_XDP: dev:%s queue:%u (%s)\n", ifname, queue,
+           (opts.flags & XDP_OPTIONS_ZEROCOPY) ? "zero-copy" : "copy");
+
+    rr_wait_setup(xsk.fd, wait);
+
+    for (;;) {
+        // frames of sent responses go back to the fill ring
+        uint32_t ncomp = xsk_ring_cons_peek(&xsk.comp);
+        if (ncomp > 0) {
+            for (uint32_t i=0; i < ncomp; i++)
+                *xsk_fill_addr(&xsk, i) = *xsk_comp_addr(&xsk, i);
+            xsk_ring_prod_submit(&xsk.fill, ncomp);
+            xsk_ring_cons_release(&xsk.comp, ncomp);
+        }
+
+        uint32_t nrx = xsk_ring_cons_peek(&xsk.rx);
+        if (nrx == 0) {
+            if (rr_wait_blocks(wait) || wait == RR_WAIT_POLL) {
+                struct pollfd pfd = { .fd = xsk.fd, .events = POLLIN };
+                if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+                    die_perr("poll");
+            } else if (wait == RR_WAIT_BUSY_POLL || xsk_ring_needs_wakeup(&xsk.fill)) {
+                recvfrom(xsk.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+            }
+            continue;
+        }
+        if (nrx > SRV_XDP_BATCH)
+            nrx = SRV_XDP_BATCH;
+
+        uint32_t ntx = 0, nfill = 0;
+        for (uint32_t i=0; i < nrx; i++) {
+            struct xdp_desc *desc = xsk_rx_desc(&xsk, i);
+            char *pkt = xsk_frame(&xsk, desc->addr);
+            struct sockaddr_storage addr;
+            socklen_t addrlen;
+            struct srv_udp_peer *peer;
+            struct udphdr *udp;
+            struct rr_hdr *req;
+            size_t len, rr_len = 0;
+
+            udp = srv_xdp_parse(pkt, desc->len, port, &addr, &addrlen);
+            if (!udp)
+                goto drop;
+            req = (struct rr_hdr *)(udp + 1);
+            len = ntohs(udp->len) - sizeof(*udp);
+            if (len < sizeof(struct rr_hdr) || req->magic != RR_MAGIC)
+                goto drop;
+
+            if (req->type == RR_TYPE_HELO) {
+                if (sizeof(struct rr_hdr) + req->helo.res_size > SRV_XDP_MAX_RR_SIZE) {
+                    fprintf(stderr, "AF_XDP: response size %u too large: dropping HELO\n", req->helo.res_size);
+                    goto drop;
+                }
+                peer = srv_udp_peer_get(peers, &addr, addrlen, true);
+                if (!peer) {
+                    fprintf(stderr, "too many UDP peers: dropping HELO\n");
+                    goto drop;
+                }
+                if (peer->req_size != req->helo.req_size || peer->res_size != req->helo.res_size) {
+                    peer->req_size = req->helo.req_size;
+                    peer->res_size = req->helo.res_size;
+                    srv_xdp_peer_print(&addr, addrlen, peer);
+                }
+                req->type = RR_TYPE_OHHI;
+                req->rrid = RR_OPT_ACK; // no options supported
+                rr_len = sizeof(*req);
+            } else if (req->type == RR_TYPE_PING) {
+                peer = srv_udp_peer_get(peers, &addr, addrlen, false);
+                if (!peer || len != sizeof(struct rr_hdr) + peer->req_size)
+                    goto drop;
+                // response payloads are all zeroes
+                rr_init_pong(req, req->rrid, peer->res_size);
+                memset(req->data, 0, peer->res_size);
+                rr_len = sizeof(*req) + peer->res_size;
+                count++;
+            } else {
+                goto drop;
+            }
+
+            struct xdp_desc *tx = xsk_tx_desc(&xsk, ntx++);
+            tx->addr = desc->addr;
+            tx->len = srv_xdp_reply(pkt, udp, rr_len);
+            tx->options = 0;
+            continue;
+        drop:
+            *xsk_fill_addr(&xsk, nfill++) = desc->addr;
+            dropped++;
+        }
+
+        xsk_ring_cons_release(&xsk.rx, nrx);
+        if (nfill > 0)
+            xsk_ring_prod_submit(&xsk.fill, nfill);
+        if (ntx > 0) {
+            xsk_ring_prod_submit(&xsk.tx, ntx);
+            if (xsk_ring_needs_wakeup(&xsk.tx) &&
+                sendto(xsk.fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+                errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+                die_perr("sendto");
+        }
+
+        dmsg("served:%zd dropped:%zd\n", count, dropped);
+    }
+}
+
+#define SRV_LISTEN_BACKLOG 128
+
+enum srv_mode {
+    SRV_MODE_BLOCK = 0,
+    SRV_MODE_EPOLL,
+    SRV_MODE_URING,
+    SRV_MODE_XDP, // UDP only: AF_XDP socket
+};
+
+struct srv_conf {
+    unsigned nthreads;
+    enum srv_mode mode;
+    bool sqpoll; // SRV_MODE_URING: use IORING_SETUP_SQPOLL
+    unsigned xdp_queue; // SRV_MODE_XDP: device queue
+    bool udp;
+    bool shm; // shm:// (block mode only)
+    enum rr_wait wait;
+    enum rr_kts kts;
+    // block mode: send responses with MSG_ZEROCOPY, or from a file
+    bool zerocopy;
+    int file_fd;
+    struct url srv_url;
+    struct addrinfo *ai_list;
+};
+
+// server threads share nothing: each one has its own (SO_REUSEPORT) listening
+// socket and serves the connections that the kernel steers to it.
+struct srv_thread {
+    pthread_t tid;
+    unsigned id;
+    struct srv_conf *conf;
+};
+
+static int
+srv_listen(struct srv_conf *conf, unsigned bind_flags) {
+    int lfd = ai_bind_flags(conf->ai_list, NULL, bind_flags);
+
+    if (!conf->udp && listen(lfd, SRV_LISTEN_BACKLOG) == -1)
+        die_perr("listen");
+
+    return lfd;
+}
+
+static void
+srv_accept_loop(struct srv_conf *conf, int lfd) {
+    for (;;) {
+        struct url cli_url;
+        struct sockaddr_storage cli_addr;
+        socklen_t cli_addr_size = sizeof(cli_addr);
+        int afd = accept(lfd, (struct sockaddr *)&cli_addr, &cli_addr_size);
+        if (afd == -1)
+            die_perr("accept");
+
+        if (url_from_peer(&cli_url, afd, (struct sockaddr *)&cli_addr, cli_addr_size) < 0)
+            die("url_from_peer failed");
+        if (conf->shm)
+            rr_shm_accept(afd, conf->wait == RR_WAIT_SPIN);
+        if (conf->mode == SRV_MODE_URING)
+            srv_uring_serve(&cli_url, afd, conf->sqpoll);
+        else
+            srv_serve(&cli_url, afd, conf->wait, conf->kts, conf->zerocopy, conf->file_fd);
+        url_free_fields(&cli_url);
+    }
+}
+
+static void
+srv_run(struct srv_conf *conf, int lfd) {
+    if (conf->mode == SRV_MODE_XDP) {
+        srv_xdp_loop(conf->ai_list, conf->xdp_queue, conf->wait);
+        return;
+    }
+
+    if (conf->udp) {
+        srv_udp_loop(lfd, conf->wait);
+        return;
+    }
+
+    switch (conf->mode) {
+        case SRV_MODE_BLOCK:
+        case SRV_MODE_URING:
+        srv_accept_loop(conf, lfd);
+        break;
+
+        case SRV_MODE_EPOLL:
+        srv_epoll_loop(lfd, conf->wait);
+        break;
+
+        case SRV_MODE_XDP:
+        abort();
+    }
+}
+
+static void *
+srv_thread(void *arg) {
+    struct srv_thread *thr = arg;
+    int cpu, lfd;
+
+    cpu = pin_self_nth_cpu(thr->id);
+    lfd = srv_listen(thr->conf, AI_BIND_REUSEPORT);
+    printf("server thread %u: cpu:%d\n", thr->id, cpu);
+    srv_run(thr->conf, lfd);
+    return NULL;
+}
+
+int
+main_srv(const char *pname, int argc, char *argv[]) {
+
+    struct srv_conf srv_conf;
+    extern char *optarg;
+    char c;
+
+    srv_conf.nthreads = 1;
+    srv_conf.mode = SRV_MODE_BLOCK;
+    srv_conf.sqpoll = false;
+    srv_conf.xdp_queue = 0;
+    srv_conf.wait = RR_WAIT_BLOCK;
+    srv_conf.kts = RR_KTS_NONE;
+    srv_conf.zerocopy = false;
+    srv_conf.file_fd = -1;
+    const char *file = NULL;
+    enum tsc_clock clock = TSC_CLOCK_AUTO;
+
+    if (argc < 2) {
+        printf("Usage: %s srv <server address> [-T nthreads] [-m mode] [-w wait] [-C clock] [-K tstamps] [-Q queue] [-Z] [-F file]\n", pname);
+        printf("\taddress: tcp://host:port, udp://host:port, unix:///path (unixpacket:// for SOCK_SEQPACKET), or shm://name\n");
+        printf("\tnthreads: number of pinned server threads, each with its own SO_REUSEPORT listener (default: %u)\n", srv_conf.nthreads);
+        printf("\tmode: block (one connection at a time per thread), epoll, uring, uring-sqpoll, or xdp (default: block)\n");
+        printf("\t      xdp: UDP over an AF_XDP socket on the device with the server address (needs CAP_NET_ADMIN and CAP_BPF)\n");
+        printf("\twait: block, poll, spin, or busy-poll (default: block). Not for uring modes.\n");
+        printf("\t      shm: spin spins on the shared rings, and everything else sleeps on a futex\n");
+        printf("\tclock: timestamp source: tsc, clock (clock_gettime), or auto (tsc if invariant) (default: auto)\n");
+        printf("\ttstamps: kernel (SO_TIMESTAMPING) timestamps: sw or hw (falls back to sw). Block mode only.\n");
+        printf("\tqueue: xdp mode: device queue to bind to (default: %u)\n", srv_conf.xdp_queue);
+        printf("\t-Z: send responses with MSG_ZEROCOPY. Block mode over TCP only.\n");
+        printf("\tfile: send the payload of each response from file (sendfile()). Block mode over TCP or unix://.\n");
+        exit(1);
+    }
+
+    if (url_parse(&srv_conf.srv_url, argv[1]) < 0)
+        die("cannot parse URL:%s\n", argv[1]);
+
+    while ( (c = getopt(argc-1, &argv[1], "T:m:w:C:K:Q:ZF:")) != -1) {
+        switch (c) {
+            case 'T':
+            if ((srv_conf.nthreads = atol(optarg)) < 1)
+                die("nthreads specified is < 1\n");
+            break;
+
+            case 'm':
+            if (strcmp(optarg, "block") == 0) {
+                srv_conf.mode = SRV_MODE_BLOCK;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                srv_conf.mode = SRV_MODE_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                srv_conf.mode = SRV_MODE_URING;
+            } else if (strcmp(optarg, "uring-sqpoll") == 0) {
+                srv_conf.mode = SRV_MODE_URING;
+                srv_conf.sqpoll = true;
+            } else if (strcmp(optarg, "xdp") == 0) {
+                srv_conf.mode = SRV_MODE_XDP;
+            } else {
+                die("unknown server mode: %s\n", optarg);
+            }
+            break;
+
+            case 'w':
+            srv_conf.wait = rr_wait_parse(optarg);
+            break;
+
+            case 'C':
+            clock = rr_clock_parse(optarg);
+            break;
+
+            case 'K':
+            srv_conf.kts = rr_kts_parse(optarg);
+            break;
+
+            case 'Q':
+            srv_conf.xdp_queue = atol(optarg);
+            break;
+
+            case 'Z':
+            srv_conf.zerocopy = true;
+            break;
+
+            case 'F':
+            file = optarg;
+            break;
+
+            default:
+            die("Unexpected option: %c\n", c);
+        }
+    }
+
+    srv_conf.ai_list = url_getaddrinfo(&srv_conf.srv_url, true);
+    if (!srv_conf.ai_list)
+        die("cannot resolve URL:%s\n", argv[1]);
+
+    srv_conf.udp = (srv_conf.ai_list->ai_socktype == SOCK_DGRAM);
+    srv_conf.shm = (strcmp(srv_conf.srv_url.prot, "shm") == 0);
+    if (srv_conf.udp && srv_conf.mode != SRV_MODE_BLOCK && srv_conf.mode != SRV_MODE_XDP)
+        die("UDP server only supports the block and xdp modes\n");
+    if (srv_conf.mode == SRV_MODE_XDP && !srv_conf.udp)
+        die("xdp mode is only supported for UDP\n");
+    if (srv_conf.mode == SRV_MODE_XDP && srv_conf.nthreads != 1)
+        die("xdp mode supports a single thread (bound to one queue)\n");
+    if (srv_conf.mode == SRV_MODE_URING && srv_conf.wait != RR_WAIT_BLOCK)
+        die("wait strategies are not supported in uring mode\n");
+    if (srv_conf.kts && (srv_conf.mode != SRV_MODE_BLOCK || srv_conf.ai_list->ai_family == AF_UNIX || srv_conf.udp))
+        die("kernel timestamps are only supported in block mode over TCP\n");
+    if (srv_conf.shm && srv_conf.mode != SRV_MODE_BLOCK)
+        die("shm is only supported in block mode\n");
+    // unix sockets cannot share an address with SO_REUSEPORT
+    if (srv_conf.ai_list->ai_family == AF_UNIX && srv_conf.nthreads != 1)
+        die("unix and shm servers support a single thread\n");
+    if ((srv_conf.zerocopy || file) && srv_conf.mode != SRV_MODE_BLOCK)
+        die("zero-copy and file responses are only supported in block mode\n");
+    if ((srv_conf.zerocopy || file) && srv_conf.kts)
+        die("zero-copy and file responses are not supported with kernel timestamps\n");
+    if (srv_conf.zerocopy && file)
+        die("-Z and -F are mutually exclusive\n");
+    if (srv_conf.zerocopy && (srv_conf.ai_list->ai_family == AF_UNIX || srv_conf.udp))
+        die("zero-copy is only supported over TCP\n");
+    if (file && (srv_conf.udp || srv_conf.shm || srv_conf.ai_list->ai_socktype != SOCK_STREAM))
+        die("file responses are only supported over TCP and unix://\n");
+    if (file) {
+        struct stat st;
+        if ((srv_conf.file_fd = open(file, O_RDONLY | O_CLOEXEC)) == -1)
+            die_perr("%s", file);
+        if (fstat(srv_conf.file_fd, &st) == -1)
+            die_perr("%s", file);
+        if (!S_ISREG(st.st_mode) || st.st_size == 0)
+            die("%s: not a regular, non-empty, file\n", file);
+    }
+
+    // for server timestamps
+    clock = tsc_clock_init(clock);
+    printf("CLOCK: %s khz:%" PRIu64 " (%s)\n", tsc_clock_name(clock), getKhz(), tsc_khz_source);
+
+    if (srv_conf.mode == SRV_MODE_XDP) {
+        srv_run(&srv_conf, -1);
+        return 0;
+    }
+
+    if (srv_conf.nthreads == 1) {
+        srv_run(&srv_conf, srv_listen(&srv_conf, 0));
+        return 0;
+    }
+
+    struct srv_thread *thrs = xcalloc(srv_conf.nthreads, sizeof(*thrs));
+    for (unsigned i=0; i < srv_conf.nthreads; i++) {
+        thrs[i].id = i;
+        thrs[i].conf = &srv_conf;
+        xpthread_create(&thrs[i].tid, NULL, srv_thread, &thrs[i]);
+    }
+
+    for (unsigned i=0; i < srv_conf.nthreads; i++)
+        xpthread_join(thrs[i].tid, NULL);
+
+    free(thrs);
+    return 0;
+}
+
+/**
+ * Client
+ */
+
+enum cli_mode {
+    CLI_MODE_SYSCALL = 0,
+    CLI_MODE_URING,
+};
+
+// parameters that a sweep (-S) varies
+enum cli_sweep_param {
+    CLI_SWEEP_BURST = 0,
+    CLI_SWEEP_REQ,
+    CLI_SWEEP_RES,
+    CLI_SWEEP_NPARAMS,
+};
+
+struct cli_sweep {
+    enum cli_sweep_param param;
+    unsigned nvals;
+    unsigned *vals;
+};
+
+// results output format (-o)
+enum cli_out {
+    CLI_OUT_TEXT = 0,
+    CLI_OUT_JSON,
+    CLI_OUT_CSV,
+};
+
+// inter-arrival time distribution for open-loop mode
+enum cli_arrival {
+    CLI_ARRIVAL_FIXED = 0,
+    CLI_ARRIVAL_POISSON, // exponentially distributed inter-arrival times
+};
+
+struct cli_conf {
+    unsigned burst;
+    unsigned nmessages;
+    unsigned req_size, res_size;
+    enum cli_mode mode;
+    bool sqpoll; // CLI_MODE_URING: use IORING_SETUP_SQPOLL
+    unsigned nconns, nthreads;
+    // open-loop mode (if rate > 0): aggregate request rate (reqs/sec), and
+    // mean inter-arrival time (in ticks) for each connection
+    double rate;
+    enum cli_arrival arrival;
+    uint64_t interval_ticks;
+    // interval reporting period (if > 0)
+    double interval_secs;
+    enum rr_wait wait;
+    // request server timestamps (RR_OPT_SRV_TSTAMPS)
+    bool srv_tstamps;
+    // server service time model (RR_OPT_SVC_TIME), if ->svc.dist is set
+    struct rr_opt_svc svc;
+    struct rr_svc_point *svc_points;
+    // protocol v2 (RR_OPT_V2)
+    bool v2;
+    enum rr_kts kts;
+    // send requests with MSG_ZEROCOPY
+    bool zerocopy;
+    // UDP: a request not answered within timeout_ticks is considered lost
+    bool udp;
+    uint64_t timeout_ticks;
+    // shm:// connections, and unixpacket:// (SOCK_SEQPACKET) ones, where
+    // each send() is a record that the server reads on its own
+    bool shm, seqpacket;
+    // results output: records (see cli_out_record()) are written to ->out,
+    // unless the format is text
+    enum cli_out out_fmt;
+    FILE *out;
+    bool out_header; // CSV header written
+    // per-request trace (-R), or NULL
+    struct trace *trace;
+    // sweep mode (if nsweep > 0): every combination of the values of the
+    // swept parameters is a point, and the first -S varies the slowest.
+    struct cli_sweep sweep[CLI_SWEEP_NPARAMS];
+    unsigned nsweep;
+    // SLO search (if slo_usecs > 0): find the highest open-loop rate where
+    // the slo_pct percentile of latency is <= slo_usecs, measuring each rate
+    // for (about) slo_secs. Each rate is a point.
+    double slo_pct, slo_usecs, slo_secs;
+    // sweep and SLO search: client threads run each point between two waits
+    // on ->points_barrier, and exit after the first one if ->points_done
+    pthread_barrier_t *points_barrier;
+    bool points_done;
+    const char *url_str;
+    struct url srv_url;
+    struct addrinfo *connect_ai;
+};
+
+// UDP HELO: the HELO or the OHHI might be lost, so retransmit the HELO until
+// we get an OHHI back.
+#define CLI_HELO_TIMEOUT_MS 200
+#define CLI_HELO_TRIES      10
+
+static void
+cli_helo_udp(int fd, struct rr_hdr *rr_helo) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct rr_hdr rr_ohhi;
+
+    for (unsigned i=0; i < CLI_HELO_TRIES; i++) {
+        if (send(fd, rr_helo, sizeof(*rr_helo), 0) != sizeof(*rr_helo)) {
+            perror("send");
+            usleep(CLI_HELO_TIMEOUT_MS*1000);
+            continue;
+        }
+
+        int ret = poll(&pfd, 1, CLI_HELO_TIMEOUT_MS);
+        if (ret == -1 && errno != EINTR)
+            die_perr("poll");
+        if (ret <= 0)
+            continue;
+
+        // e.g., ECONNREFUSED if the server is not up (yet)
+        ssize_t nreceived = recv(fd, &rr_ohhi, sizeof(rr_ohhi), MSG_DONTWAIT);
+        if (nreceived == -1) {
+            perror("recv");
+            usleep(CLI_HELO_TIMEOUT_MS*1000);
+            continue;
+        }
+
+        if (nreceived != sizeof(rr_ohhi) || rr_ohhi.magic != RR_MAGIC || rr_ohhi.type != RR_TYPE_OHHI)
+            die("invalid protocol");
+        return;
+    }
+
+    die("bailing out after %d helo attempts\n", CLI_HELO_TRIES);
+}
+
+// HELO/OHHI exchange. If server timestamps are requested, returns the
+// frequency of the server's ticks in *@srv_khz.
+static void
+cli_helo(struct cli_conf *conf, int fd, uint64_t *srv_khz) {
+
+    struct rr_hdr rr_helo;
+    struct {
+        struct rr_hdr hdr;
+        struct rr_opt_tstamps tstamps;
+    } __attribute__((packed)) rr_ohhi;
+    size_t ohhi_size = sizeof(rr_ohhi.hdr) + (conf->srv_tstamps ? sizeof(rr_ohhi.tstamps) : 0);
+    unsigned helo_errs=0;
+
+    rr_init_helo(&rr_helo, MIN(conf->req_size, RR_V1_MAX_SIZE), MIN(conf->res_size, RR_V1_MAX_SIZE));
+    if (conf->srv_tstamps)
+        rr_helo.rrid |= RR_OPT_SRV_TSTAMPS;
+    if (conf->svc.dist)
+        rr_helo.rrid |= RR_OPT_SVC_TIME;
+    if (conf->v2)
+        rr_helo.rrid |= RR_OPT_V2;
+    if (conf->points_barrier)
+        rr_helo.rrid |= RR_OPT_SWEEP;
+    if (conf->udp) {
+        cli_helo_udp(fd, &rr_helo);
+        return;
+    }
+
+    // the HELO and the payload of its options are sent with a single send()
+    char *helo = xmalloc(RR_HELO_MAX_SIZE);
+    size_t helo_size = 0;
+    memcpy(helo, &rr_helo, sizeof(rr_helo));
+    helo_size += sizeof(rr_helo);
+    if (conf->svc.dist) {
+        memcpy(helo + helo_size, &conf->svc, sizeof(conf->svc));
+        helo_size += sizeof(conf->svc);
+        if (conf->svc.dist == RR_SVC_CDF) {
+            memcpy(helo + helo_size, conf->svc_points, conf->svc.npoints*sizeof(*conf->svc_points));
+            helo_size += conf->svc.npoints*sizeof(*conf->svc_points);
+        }
+    }
+    if (conf->v2) {
+        struct rr_opt_v2 v2 = { .req_size = conf->req_size, .res_size = conf->res_size };
+        memcpy(helo + helo_size, &v2, sizeof(v2));
+        helo_size += sizeof(v2);
+    }
+
+	for (unsigned i=0; ;) {
+        int nsent = rr_send(fd, helo, helo_size, 0);
+		if (nsent == (int)helo_size) {
+            break;
+        }
+        perror("send");
+	    if (++i == helo_errs)
+	        die("bailing out after %d helo attempts\n", helo_errs);
+	}
+	free(helo);
+
+	// NB: the OHHI and its options are read with a single recv(), because
+	// on SOCK_SEQPACKET sockets the rest of the record would be discarded
+	int nreceived = rr_recv(fd, &rr_ohhi, ohhi_size, 0);
+	if (nreceived < (int)sizeof(rr_ohhi.hdr))
+	    die_perr("recv");
+
+    if (rr_ohhi.hdr.magic != RR_MAGIC || rr_ohhi.hdr.type != RR_TYPE_OHHI)
+        die("invalid protocol");
+
+    // an OHHI without RR_OPT_ACK is an echo of the HELO: nothing is acked
+    unsigned acked = (rr_ohhi.hdr.rrid & RR_OPT_ACK) ? rr_ohhi.hdr.rrid : 0;
+    if (conf->srv_tstamps) {
+        if (!(acked & RR_OPT_SRV_TSTAMPS))
+            die("server does not support timestamps\n");
+        size_t rem = ohhi_size - nreceived;
+        if (rem > 0 && rr_recv(fd, (char *)&rr_ohhi + nreceived, rem, MSG_WAITALL) != (ssize_t)rem)
+            die_perr("recv");
+        *srv_khz = rr_ohhi.tstamps.khz;
+    }
+
+    if (conf->svc.dist && !(acked & RR_OPT_SVC_TIME))
+        die("server does not support service times (block mode only)\n");
+    if (conf->v2 && !(acked & RR_OPT_V2))
+        die("server does not support protocol v2\n");
+    if (conf->points_barrier && !(acked & RR_OPT_SWEEP))
+        die("server does not support sweeps or SLO searches (block or epoll mode, without kernel timestamps, only)\n");
+}
+
+
+static void
+report_ticks(struct hist *h) {
+    uint64_t avg = hist_avg(h);
+    uint64_t med = hist_percentile(h, 50.0);
+    uint64_t min = h->min;
+    uint64_t max = h->max;
+
+    printf("TICKS: avg:%lu (%lf usecs) med:%lu (%lf usecs) min:%lu (%lf usecs) max:%lu (%lf usecs)\n",
+            avg, __tsc_getusecs(avg),
+            med, __tsc_getusecs(med),
+            min, __tsc_getusecs(min),
+            max, __tsc_getusecs(max));
+
+    report_percentiles("PERCENTILES", h);
+}
+
+/**
+ * Latency recording
+ *
+ * Each client thread records latencies in a cumulative histogram, and, if
+ * interval reporting is enabled, in an interval histogram (struct cli_ival).
+ *
+ * Interval histograms are swapped without locks or syscalls in the hot path:
+ * the reporter thread sets ->req to ask for a new interval, and the client
+ * thread, when it records its next latency, notices, moves its current
+ * histogram to ->full, switches to ->spare, and acknowledges by setting ->ack
+ * to ->req. This costs the client thread a (normally cache-hit) load per
+ * recorded latency.
+ */
+
+struct cli_ival {
+    struct hist *cur;          // owned by the client thread
+    struct hist *spare, *full; // handed off between client and reporter
+    unsigned req, ack;
+};
+
+// With server timestamps, the round-trip time of each request is also split
+// into the time spent in the server (between receiving the request and
+// sending the response), recorded in ->srv, and the rest (network, both
+// stacks, and client-side queueing), recorded in ->net.
+//
+// With kernel timestamps, it is split into the client's TX path (user-space
+// send to the kernel TX timestamp), recorded in ->ktx, the time between the
+// kernel TX and RX timestamps (network and server), recorded in ->kwire, and
+// the client's RX path (kernel RX timestamp to user-space recv, including
+// wakeup and scheduling), recorded in ->krx. If hardware timestamps are
+// available, the time between the NIC TX and RX timestamps is recorded in
+// ->knic. Requests without timestamps are counted in ->kts_missing.
+//
+// All of these are cumulative only, and in client ticks.
+struct cli_lat {
+    struct hist *cum;
+    struct cli_ival *ival; // NULL if there is no interval reporting
+    struct hist *srv, *net; // NULL without server timestamps
+    struct hist *ktx, *kwire, *krx, *knic; // NULL without kernel timestamps
+    size_t kts_missing;
+};
+
+static struct hist *
+cli_hist_alloc(void) {
+    struct hist *h = xmalloc(sizeof(struct hist));
+    hist_init(h);
+    return h;
+}
+
+static void
+cli_lat_init(struct cli_lat *lat, struct cli_ival *ival, struct cli_conf *conf) {
+    lat->cum = cli_hist_alloc();
+
+    lat->srv = lat->net = NULL;
+    if (conf->srv_tstamps) {
+        lat->srv = cli_hist_alloc();
+        lat->net = cli_hist_alloc();
+    }
+
+    lat->ktx = lat->kwire = lat->krx = lat->knic = NULL;
+    lat->kts_missing = 0;
+    if (conf->kts) {
+        lat->ktx = cli_hist_alloc();
+        lat->kwire = cli_hist_alloc();
+        lat->krx = cli_hist_alloc();
+        lat->knic = cli_hist_alloc();
+    }
+
+    lat->ival = ival;
+    if (ival) {
+        ival->cur = xmalloc(sizeof(struct hist));
+        hist_init(ival->cur);
+        ival->spare = xmalloc(sizeof(struct hist));
+        hist_init(ival->spare);
+        ival->full = NULL;
+        ival->req = ival->ack = 0;
+    }
+}
+
+static void
+cli_lat_fini(struct cli_lat *lat) {
+    free(lat->cum);
+    free(lat->srv);
+    free(lat->net);
+    free(lat->ktx);
+    free(lat->kwire);
+    free(lat->krx);
+    free(lat->knic);
+    if (lat->ival) {
+        free(lat->ival->cur);
+        free(lat->ival->spare);
+        free(lat->ival->full);
+    }
+}
+
+static inline void
+cli_lat_add(struct cli_lat *lat, uint64_t ticks) {
+    hist_add(lat->cum, ticks);
+
+    struct cli_ival *ival = lat->ival;
+    if (!ival)
+        return;
+
+    // without a ->spare (the reporter did not collect ->full yet), keep
+    // recording in ->cur, and acknowledge later
+    unsigned req = __atomic_load_n(&ival->req, __ATOMIC_ACQUIRE);
+    if (unlikely(req != ival->ack) && ival->spare) {
+        ival->full = ival->cur;
+        ival->cur = ival->spare;
+        ival->spare = NULL;
+        __atomic_store_n(&ival->ack, req, __ATOMIC_RELEASE);
+    }
+    hist_add(ival->cur, ticks);
+}
+
+// record the split of a round-trip time of @ticks, of which @srv_ticks were
+// spent in the server
+static inline void
+cli_lat_add_split(struct cli_lat *lat, uint64_t ticks, uint64_t srv_ticks) {
+    hist_add(lat->srv, srv_ticks);
+    hist_add(lat->net, ticks > srv_ticks ? ticks - srv_ticks : 0);
+}
+
+// record the kernel timestamp split of a request that was sent at @send_ns,
+// and whose response was read at @recv_ns
+static inline void
+cli_lat_add_kts(struct cli_lat *lat, uint64_t send_ns, const struct sock_tstamp *tx,
+                const struct sock_tstamp *rx, uint64_t recv_ns) {
+    if (!tx->sw || !rx->sw) {
+        lat->kts_missing++;
+        return;
+    }
+
+    hist_add(lat->ktx, rr_ns_diff_ticks(tx->sw, send_ns));
+    hist_add(lat->kwire, rr_ns_diff_ticks(rx->sw, tx->sw));
+    hist_add(lat->krx, rr_ns_diff_ticks(recv_ns, rx->sw));
+    if (tx->hw && rx->hw)
+        hist_add(lat->knic, rr_ns_diff_ticks(rx->hw, tx->hw));
+}
+
+// merge the cumulative histograms (and counts) of @src into @dst
+static void
+cli_lat_merge(struct cli_lat *dst, const struct cli_lat *src) {
+    hist_merge(dst->cum, src->cum);
+    if (dst->srv) {
+        hist_merge(dst->srv, src->srv);
+        hist_merge(dst->net, src->net);
+    }
+    if (dst->ktx) {
+        hist_merge(dst->ktx, src->ktx);
+        hist_merge(dst->kwire, src->kwire);
+        hist_merge(dst->krx, src->krx);
+        hist_merge(dst->knic, src->knic);
+        dst->kts_missing += src->kts_missing;
+    }
+}
+
+// the rest of an interval or sweep point line: duration, throughput, and
+// latencies (in usecs) of @h
+static void
+report_hist_line(double secs, struct hist *h) {
+    printf("secs:%.3lf count:%lu reqs/sec:%.1lf", secs, h->count, h->count / secs);
+    if (h->count > 0) {
+        static const double pcts[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+        printf(" avg:%.3lf", __tsc_getusecs(hist_avg(h)));
+        for (size_t i=0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+            printf(" p%g:%.3lf", pcts[i], __tsc_getusecs(hist_percentile(h, pcts[i])));
+        printf(" max:%.3lf (usecs)", __tsc_getusecs(h->max));
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void
+report_interval(unsigned idx, double secs, struct hist *h) {
+    printf("INTERVAL %u: ", idx);
+    report_hist_line(secs, h);
+}
+
+/**
+ * Machine-readable results (-o json|csv)
+ *
+ * One record per run, and, with interval reporting, one per interval. Each
+ * record repeats the configuration, so records of different runs can be
+ * compared on their own. JSON records are single-line objects (JSON lines).
+ * CSV records are rows, under a header written before the first one.
+ *
+ * Latencies are in usecs. Histogram buckets are raw: the lowest value (in
+ * ticks) and the count of each non-empty bucket (see hist.h), so histograms
+ * can be merged and percentiles recomputed offline. khz converts ticks to
+ * time.
+ */
+
+static const double cli_out_pcts[] = { 1.0, 10.0, 25.0, 50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99 };
+#define CLI_OUT_NPCTS (sizeof(cli_out_pcts) / sizeof(cli_out_pcts[0]))
+
+struct cli_record {
+    const char *type; // "run", "interval", "point" (of a sweep), or "step"/"knee" (of an SLO search)
+    unsigned idx;     // interval, point, or step number (0 for runs)
+    double secs;
+    struct hist *h;   // round-trip latencies
+    // runs, points, and steps only: totals (req/res_bytes: payload bytes of
+    // the requests sent, and of the responses received), and the latency
+    // split histograms
+    bool totals;
+    size_t sent, received, errors, lost;
+    size_t req_bytes, res_bytes;
+    double cpu_secs;
+    struct cli_lat *lat;
+};
+
+// where diagnostics go: stdout, unless records are written there
+static FILE *
+cli_diag(struct cli_conf *conf) {
+    return conf->out_fmt == CLI_OUT_TEXT ? stdout : stderr;
+}
+
+static enum cli_out
+cli_out_parse(const char *str, const char **file) {
+    enum cli_out fmt;
+    const char *sep = strchr(str, ':');
+    size_t len = sep ? (size_t)(sep - str) : strlen(str);
+
+    if (len == 4 && strncmp(str, "text", len) == 0)
+        fmt = CLI_OUT_TEXT;
+    else if (len == 4 && strncmp(str, "json", len) == 0)
+        fmt = CLI_OUT_JSON;
+    else if (len == 3 && strncmp(str, "csv", len) == 0)
+        fmt = CLI_OUT_CSV;
+    else
+        die("unknown output format: %s\n", str);
+
+    *file = (sep && sep[1]) ? sep + 1 : NULL;
+    return fmt;
+}
+
+static const char *
+cli_mode_name(struct cli_conf *conf) {
+    if (conf->mode == CLI_MODE_URING)
+        return conf->sqpoll ? "uring-sqpoll" : "uring";
+    return "syscall";
+}
+
+static void
+cli_out_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void
+cli_out_json_hist(FILE *f, const char *name, const struct hist *h) {
+    fprintf(f, ",\"%s\":{\"count\":%" PRIu64, name, h->count);
+    if (h->count > 0) {
+        fprintf(f, ",\"min\":%.3f,\"avg\":%.3f", __tsc_getusecs(h->min), __tsc_getusecs(hist_avg(h)));
+        for (size_t i=0; i < CLI_OUT_NPCTS; i++)
+            fprintf(f, ",\"p%g\":%.3f", cli_out_pcts[i], __tsc_getusecs(hist_percentile(h, cli_out_pcts[i])));
+        fprintf(f, ",\"max\":%.3f", __tsc_getusecs(h->max));
+    }
+    fprintf(f, ",\"buckets\":[");
+    bool first = true;
+    for (unsigned b=0; b < HIST_NBUCKETS; b++) {
+        uint64_t width;
+        if (h->buckets[b] == 0)
+            continue;
+        fprintf(f, "%s[%" PRIu64 ",%" PRIu64 "]", first ? "" : ",", hist_bucket_low(b, &width), h->buckets[b]);
+        first = false;
+    }
+    fprintf(f, "]}");
+}
+
+// goodput (Gbit/s) of @bytes over @secs
+static double
+cli_gbps(size_t bytes, double secs) {
+    return secs > 0 ? bytes * 8 / secs / 1e9 : 0.0;
+}
+
+static void
+cli_out_json(struct cli_conf *conf, struct cli_record *rec) {
+    FILE *f = conf->out;
+
+    fprintf(f, "{\"type\":\"%s\",\"idx\":%u,\"config\":{\"url\":", rec->type, rec->idx);
+    cli_out_json_str(f, conf->url_str);
+    fprintf(f, ",\"transport\":");
+    cli_out_json_str(f, conf->srv_url.prot);
+    fprintf(f, ",\"mode\":\"%s\",\"version\":%d,\"burst\":%u,\"nmessages\":%u"
+               ",\"req_size\":%u,\"res_size\":%u,\"conns\":%u,\"threads\":%u"
+               ",\"rate\":%.1f,\"arrival\":\"%s\"}",
+            cli_mode_name(conf), conf->v2 ? 2 : 1, conf->burst, conf->nmessages,
+            conf->req_size, conf->res_size, conf->nconns, conf->nthreads,
+            conf->rate, conf->arrival == CLI_ARRIVAL_POISSON ? "poisson" : "fixed");
+    fprintf(f, ",\"khz\":%" PRIu64 ",\"secs\":%.6f,\"reqs_per_sec\":%.1f",
+            getKhz(), rec->secs, rec->secs > 0 ? rec->h->count / rec->secs : 0.0);
+    if (rec->totals) {
+        fprintf(f, ",\"sent\":%zd,\"received\":%zd,\"errors\":%zd,\"lost\":%zd,\"cpu_secs\":%.3f",
+                rec->sent, rec->received, rec->errors, rec->lost, rec->cpu_secs);
+        fprintf(f, ",\"req_bytes\":%zd,\"res_bytes\":%zd,\"req_gbps\":%.6f,\"res_gbps\":%.6f",
+                rec->req_bytes, rec->res_bytes, cli_gbps(rec->req_bytes, rec->secs), cli_gbps(rec->res_bytes, rec->secs));
+    }
+
+    cli_out_json_hist(f, "latency", rec->h);
+    struct cli_lat *lat = rec->lat;
+    if (lat && lat->srv) {
+        cli_out_json_hist(f, "server", lat->srv);
+        cli_out_json_hist(f, "network", lat->net);
+    }
+    if (lat && lat->ktx) {
+        cli_out_json_hist(f, "kernel_tx", lat->ktx);
+        cli_out_json_hist(f, "kernel_wire", lat->kwire);
+        cli_out_json_hist(f, "kernel_rx", lat->krx);
+        if (lat->knic->count > 0)
+            cli_out_json_hist(f, "nic", lat->knic);
+        fprintf(f, ",\"kernel_missing\":%zd", lat->kts_missing);
+    }
+    fprintf(f, "}\n");
+}
+
+static void
+cli_out_csv_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// CSV records only have the round-trip latencies. Buckets are a single field
+// of space-separated <lowest value>:<count> pairs.
+static void
+cli_out_csv(struct cli_conf *conf, struct cli_record *rec) {
+    FILE *f = conf->out;
+    struct hist *h = rec->h;
+
+    if (!conf->out_header) {
+        fprintf(f, "type,idx,url,transport,mode,version,burst,nmessages,req_size,res_size,conns,threads,rate,arrival"
+                   ",khz,secs,count,reqs_per_sec,sent,received,errors,lost,cpu_secs"
+                   ",req_bytes,res_bytes,req_gbps,res_gbps,min,avg");
+        for (size_t i=0; i < CLI_OUT_NPCTS; i++)
+            fprintf(f, ",p%g", cli_out_pcts[i]);
+        fprintf(f, ",max,buckets\n");
+        conf->out_header = true;
+    }
+
+    fprintf(f, "%s,%u,", rec->type, rec->idx);
+    cli_out_csv_str(f, conf->url_str);
+    fputc(',', f);
+    cli_out_csv_str(f, conf->srv_url.prot);
+    fprintf(f, ",%s,%d,%u,%u,%u,%u,%u,%u,%.1f,%s",
+            cli_mode_name(conf), conf->v2 ? 2 : 1, conf->burst, conf->nmessages,
+            conf->req_size, conf->res_size, conf->nconns, conf->nthreads,
+            conf->rate, conf->arrival == CLI_ARRIVAL_POISSON ? "poisson" : "fixed");
+    fprintf(f, ",%" PRIu64 ",%.6f,%" PRIu64 ",%.1f", getKhz(), rec->secs, h->count,
+            rec->secs > 0 ? h->count / rec->secs : 0.0);
+    if (rec->totals) {
+        fprintf(f, ",%zd,%zd,%zd,%zd,%.3f", rec->sent, rec->received, rec->errors, rec->lost, rec->cpu_secs);
+        fprintf(f, ",%zd,%zd,%.6f,%.6f", rec->req_bytes, rec->res_bytes,
+                cli_gbps(rec->req_bytes, rec->secs), cli_gbps(rec->res_bytes, rec->secs));
+    } else {
+        fprintf(f, ",,,,,,,,,");
+    }
+
+    if (h->count > 0) {
+        fprintf(f, ",%.3f,%.3f", __tsc_getusecs(h->min), __tsc_getusecs(hist_avg(h)));
+        for (size_t i=0; i < CLI_OUT_NPCTS; i++)
+            fprintf(f, ",%.3f", __tsc_getusecs(hist_percentile(h, cli_out_pcts[i])));
+        fprintf(f, ",%.3f", __tsc_getusecs(h->max));
+    } else {
+        for (size_t i=0; i < CLI_OUT_NPCTS + 3; i++)
+            fputc(',', f);
+    }
+
+    fprintf(f, ",\"");
+    bool first = true;
+    for (unsigned b=0; b < HIST_NBUCKETS; b++) {
+        uint64_t width;
+        if (h->buckets[b] == 0)
+            continue;
+        fprintf(f, "%s%" PRIu64 ":%" PRIu64, first ? "" : " ", hist_bucket_low(b, &width), h->buckets[b]);
+        first = false;
+    }
+    fprintf(f, "\"\n");
+}
+
+static void
+cli_out_record(struct cli_conf *conf, struct cli_record *rec) {
+    switch (conf->out_fmt) {
+        case CLI_OUT_JSON:
+        cli_out_json(conf, rec);
+        break;
+
+        case CLI_OUT_CSV:
+        cli_out_csv(conf, rec);
+        break;
+
+        case CLI_OUT_TEXT:
+        abort();
+    }
+    fflush(conf->out);
+}
+
+static double
+cli_now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// client connection state
+//
+// Requests on a connection are answered in order, so at most burst rrids,
+// all in [sent - burst, sent), are in flight. Their send timestamps are kept
+// in ->stamps, indexed by rrid % burst.
+//
+// Requests are queued in ->sbuf and sent together. ->soff out of ->slen bytes
+// of it are sent. With MSG_ZEROCOPY, ->sbuf is the current buffer of ->zc,
+// and NULL if none of its buffers can be written yet.
+//
+// UDP connections keep per-request state in ->slots instead of ->stamps (see
+// cli_udp_ping_pong()), and finish when all requests are either received or
+// lost.
+#define CLI_UDP_BATCH 32
+
+enum cli_udp_state {
+    CLI_UDP_FREE = 0,
+    CLI_UDP_INFLIGHT,
+    CLI_UDP_ANSWERED,
+    CLI_UDP_LOST,
+};
+
+// requests we keep state for: all in [oldest, sent). It is larger than
+// burst, so that a single slow request does not limit the in-flight ones.
+#define CLI_UDP_WINDOW(burst) (2*(burst))
+
+struct cli_udp_slot {
+    uint64_t stamp;    // send timestamp
+    uint64_t deadline; // the request is lost if not answered by then
+    uint32_t rrid;
+    enum cli_udp_state state;
+};
+
+struct cli_kts {
+    uint64_t send_ns;
+    struct sock_tstamp tx;
+};
+
+struct cli_conn {
+    int fd;
+    size_t errors, sent, received;
+    unsigned in_flight;
+    uint32_t sum1, sum2;
+    size_t req_buff_size, res_buff_size;
+    char *sbuf;
+    size_t scap, slen, soff;
+    size_t smax; // max bytes per send()
+    struct rr_zc *zc;
+    // trace records of this connection (indexed by rrid), or NULL
+    struct trace_rec *trace;
+    unsigned idx;
+    struct rr_rbuf rb;
+    uint64_t *stamps;
+    // open-loop mode: intended send time of the next request
+    uint64_t next_send;
+    unsigned short xsubi[3];
+    // server timestamps: client ticks per server tick
+    double srv_tick_scale;
+    // kernel timestamps: per in-flight request, indexed like ->stamps, and
+    // the next requests waiting for a (software/hardware) TX timestamp
+    struct cli_kts *kts;
+    size_t tx_next_sw, tx_next_hw;
+    // UDP
+    size_t lost, late, duplicates, reordered;
+    struct cli_udp_slot *slots;
+    size_t oldest;  // oldest request that might be in flight
+    size_t rx_next; // (highest rrid received) + 1
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    char *ubuf;     // receive buffers: CLI_UDP_BATCH datagrams
+};
+
+static void
+cli_conn_init(struct cli_conf *conf, struct cli_conn *conn, int fd, uint64_t srv_khz) {
+    rr_wait_setup(fd, conf->wait);
+    conn->fd = fd;
+    conn->errors = conn->sent = conn->received = 0;
+    conn->in_flight = 0;
+    conn->sum1 = conn->sum2 = 0;
+
+    conn->req_buff_size = conf->udp ? sizeof(struct rr_hdr) + conf->req_size : rr_msg_size(conf->v2, conf->req_size);
+    conn->scap = rr_buff_cap(conn->req_buff_size, conf->burst);
+    conn->trace = NULL;
+    conn->idx = 0;
+    conn->zc = NULL;
+    if (conf->zerocopy)
+        conn->zc = rr_zc_init(fd, conn->scap);
+    for (unsigned i=0; i < (conn->zc ? RR_ZC_NBUFS : 1); i++) {
+        conn->sbuf = conn->zc ? conn->zc->bufs[i] : xcalloc(1, conn->scap);
+        for (size_t off=0; off < conn->scap; off += conn->req_buff_size)
+            rr_msg_init(conf->v2, conn->sbuf + off, RR_TYPE_PING, 0, conf->req_size);
+    }
+    if (conn->zc)
+        conn->sbuf = rr_zc_buf(conn->zc, true);
+    conn->slen = conn->soff = 0;
+    conn->smax = conf->seqpacket ? conn->req_buff_size : SIZE_MAX;
+
+    conn->res_buff_size = rr_msg_size(conf->v2, conf->res_size);
+    conn->srv_tick_scale = 0;
+    if (conf->srv_tstamps) {
+        conn->res_buff_size = rr_msg_size(conf->v2, conf->res_size + sizeof(struct rr_srv_tstamps));
+        conn->srv_tick_scale = (double)getKhz() / (double)srv_khz;
+    }
+    rr_rbuf_init(&conn->rb, rr_buff_cap(conn->res_buff_size, conf->burst));
+
+    conn->stamps = xcalloc(conf->burst, sizeof(uint64_t));
+    conn->next_send = 0;
+    conn->xsubi[0] = fd;
+    conn->xsubi[1] = getpid();
+    conn->xsubi[2] = get_ticks();
+
+    // after the HELO exchange, so that TX keys start at the first request
+    // (OPT_ID_TCP: even if the HELO is not acked yet)
+    conn->kts = NULL;
+    conn->tx_next_sw = conn->tx_next_hw = 0;
+    if (conf->kts) {
+        rr_kts_enable(fd, conf->kts);
+        conn->kts = xcalloc(conf->burst, sizeof(*conn->kts));
+    }
+
+    conn->lost = conn->late = conn->duplicates = conn->reordered = 0;
+    conn->slots = NULL;
+    conn->msgs = NULL;
+    conn->iovs = NULL;
+    conn->ubuf = NULL;
+    if (conf->udp) {
+        unsigned nmsgs = MAX(conn->scap / conn->req_buff_size, (size_t)CLI_UDP_BATCH);
+        conn->slots = xcalloc(CLI_UDP_WINDOW(conf->burst), sizeof(*conn->slots));
+        conn->oldest = conn->rx_next = 0;
+        conn->msgs = xcalloc(nmsgs, sizeof(*conn->msgs));
+        conn->iovs = xcalloc(nmsgs, sizeof(*conn->iovs));
+        conn->ubuf = xmalloc(CLI_UDP_BATCH*conn->res_buff_size);
+    }
+}
+
+// NB: does not close the connection, so that a sweep can reuse it
+static void
+cli_conn_fini(struct cli_conn *conn) {
+    if (conn->sum1 != conn->sum2)
+        die("checksum failed: %u =/= %u\n", conn->sum1, conn->sum2);
+
+    if (conn->zc)
+        rr_zc_fini(conn->zc);
+    else
+        free(conn->sbuf);
+    rr_rbuf_fini(&conn->rb);
+    free(conn->stamps);
+    free(conn->kts);
+    free(conn->slots);
+    free(conn->msgs);
+    free(conn->iovs);
+    free(conn->ubuf);
+}
+
+static inline bool
+cli_conn_done(struct cli_conf *conf, struct cli_conn *conn) {
+    return conn->received + conn->lost == conf->nmessages;
+}
+
+// record request @rrid, sent at @send and answered at @recv (in ticks), in
+// the trace. @ts are its server timestamps, if any.
+static inline void
+cli_conn_trace(struct cli_conf *conf, struct cli_conn *conn, uint64_t rrid,
+               uint64_t send, uint64_t recv, const struct rr_srv_tstamps *ts) {
+    struct trace_rec *r = &conn->trace[rrid];
+    r->rrid = rrid;
+    r->conn = conn->idx;
+    r->flags = TRACE_REC_F_RECEIVED;
+    r->send_tsc = send;
+    r->recv_tsc = recv;
+    r->req_size = conf->req_size;
+    r->res_size = conf->res_size;
+    if (ts) {
+        r->flags |= TRACE_REC_F_SRV_TSTAMPS;
+        r->srv_rx = ts->rx;
+        r->srv_tx = ts->tx;
+    }
+}
+
+// can we queue another request?
+static inline bool
+cli_conn_can_queue(struct cli_conf *conf, struct cli_conn *conn) {
+    return conn->in_flight < conf->burst && conn->sent < conf->nmessages &&
+           conn->sbuf && conn->slen + conn->req_buff_size <= conn->scap;
+}
+
+// queue the next request, with send timestamp @stamp
+static inline void
+cli_conn_queue(struct cli_conf *conf, struct cli_conn *conn, uint64_t stamp) {
+    rr_msg_set_ping(conf->v2, conn->sbuf + conn->slen, conn->sent, stamp);
+    conn->slen += conn->req_buff_size;
+    conn->stamps[conn->sent % conf->burst] = stamp;
+    if (conn->kts) {
+        struct cli_kts *k = &conn->kts[conn->sent % conf->burst];
+        k->send_ns = rr_realtime_ns();
+        k->tx.sw = k->tx.hw = 0;
+    }
+    conn->sum1 += conn->sent;
+    conn->sent++;
+    conn->in_flight++;
+}
+
+// send queued requests without blocking
+// returns true if everything was sent, and sets *@progress if anything was.
+static bool
+cli_conn_flush(struct cli_conn *conn, bool *progress) {
+    while (conn->soff < conn->slen) {
+        size_t len = MIN(conn->slen - conn->soff, conn->smax);
+        ssize_t ret = conn->zc ? rr_zc_send(conn->zc, conn->soff, len, MSG_DONTWAIT)
+                               : rr_send(conn->fd, conn->sbuf + conn->soff, len, MSG_DONTWAIT);
+        if (ret == -1) {
+            conn->errors++;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            die_perr("send");
+        }
+        conn->soff += ret;
+        *progress = true;
+    }
+
+    conn->slen = conn->soff = 0;
+    if (conn->zc)
+        conn->sbuf = rr_zc_buf(conn->zc, false);
+    return true;
+}
+
+// try to send as many as possible without blocking or overcomming the
+// in-flight limit. Returns true if anything was sent.
+static bool
+cli_conn_send(struct cli_conf *conf, struct cli_conn *conn) {
+    bool progress = false;
+
+    if (!cli_conn_flush(conn, &progress))
+        return progress;
+
+    // NB: take the timestamp before sending, because the response might
+    // arrive before send() returns.
+    uint64_t t = get_ticks();
+    while (cli_conn_can_queue(conf, conn))
+        cli_conn_queue(conf, conn, t);
+    cli_conn_flush(conn, &progress);
+
+    return progress;
+}
+
+// match TX timestamps from the error queue with requests
+//
+// The key of a TX timestamp is the offset of the last byte of a send(), so it
+// is the TX timestamp of all the requests that the send() completed.
+static void
+cli_conn_read_tx_tstamps(struct cli_conf *conf, struct cli_conn *conn) {
+    const uint64_t last = conn->sent*conn->req_buff_size - 1;
+    struct sock_tstamp ts;
+    uint32_t key;
+    int ret;
+
+    while ((ret = sock_tstamp_read_tx(conn->fd, &key, &ts)) == 1) {
+        size_t n = (rr_kts_key64(key, last) + 1) / conn->req_buff_size;
+        size_t *next = ts.hw ? &conn->tx_next_hw : &conn->tx_next_sw;
+        for (; *next < n; (*next)++) {
+            // the slot might be reused, if the timestamp came too late
+            if (conn->sent - *next > conf->burst)
+                continue;
+            struct cli_kts *k = &conn->kts[*next % conf->burst];
+            if (ts.hw)
+                k->tx.hw = ts.hw;
+            else
+                k->tx.sw = ts.sw;
+        }
+    }
+    if (ret == -1)
+        die_perr("recvmsg(MSG_ERRQUEUE)");
+}
+
+// try to receive as many as possible. If @may_block is set, we block until
+// at least one response arrives, and also keep blocking for more if there is
+// nothing left to send. Returns true if anything was received.
+static bool
+cli_conn_recv(struct cli_conf *conf, struct cli_conn *conn,
+              struct cli_lat *lat, bool may_block) {
+    bool recv_one = false;
+    void *res;
+
+    // blocking with unsent requests might deadlock, if the server has not
+    // received a complete request to respond to.
+    if (conn->slen > 0)
+        may_block = false;
+
+    while (conn->in_flight > 0) {
+
+        // do not block if there are more messages we can send
+        bool more = conn->sent < conf->nmessages;
+        int noblock = (!may_block || (more && recv_one)) ? MSG_DONTWAIT : 0;
+
+        struct sock_tstamp rxts;
+        ssize_t ret = conn->kts ? rr_rbuf_recv_tstamp(&conn->rb, conn->fd, noblock, &rxts)
+                                : rr_rbuf_recv(&conn->rb, conn->fd, noblock);
+        if (ret == -1) {
+            conn->errors++;
+            if (noblock && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            die_perr("recv");
+        } else if (ret == 0) {
+            die("connection closed by server\n");
+        }
+
+        uint64_t t = get_ticks();
+        uint64_t recv_ns = 0;
+        if (conn->kts) {
+            recv_ns = rr_realtime_ns();
+            cli_conn_read_tx_tstamps(conf, conn);
+        }
+        while ((res = rr_rbuf_next(&conn->rb, conn->res_buff_size)) != NULL) {
+            if (!rr_msg_is(conf->v2, res, RR_TYPE_PONG) || rr_msg_dlen(conf->v2, res) != conf->res_size)
+                die("invalid protocol");
+
+            uint64_t rrid = rr_msg_rrid(conf->v2, res);
+            if (rrid >= conn->sent || conn->sent - rrid > conf->burst)
+                die("unexpected rrid: %" PRIu64 " (sent: %zd)\n", rrid, conn->sent);
+
+            uint64_t ticks = t - conn->stamps[rrid % conf->burst];
+            struct rr_srv_tstamps *ts = conf->srv_tstamps ? rr_msg_data(conf->v2, res) : NULL;
+            cli_lat_add(lat, ticks);
+            if (ts)
+                cli_lat_add_split(lat, ticks, (uint64_t)((ts->tx - ts->rx)*conn->srv_tick_scale));
+            if (conn->trace)
+                cli_conn_trace(conf, conn, rrid, conn->stamps[rrid % conf->burst], t, ts);
+            if (conn->kts) {
+                struct cli_kts *k = &conn->kts[rrid % conf->burst];
+                cli_lat_add_kts(lat, k->send_ns, &k->tx, &rxts, recv_ns);
+            }
+            recv_one = true;
+            conn->received++;
+            conn->sum2 += rrid;
+            conn->in_flight--;
+        }
+    }
+
+    return recv_one;
+}
+
+// open-loop mode: next inter-arrival time, in ticks
+static inline uint64_t
+cli_conn_interval(struct cli_conf *conf, struct cli_conn *conn) {
+    switch (conf->arrival) {
+        case CLI_ARRIVAL_FIXED:
+        return conf->interval_ticks;
+
+        case CLI_ARRIVAL_POISSON:
+        return (uint64_t)(-log(1.0 - erand48(conn->xsubi)) * (double)conf->interval_ticks);
+    }
+    abort();
+}
+
+// open-loop mode: send all the requests whose intended send time is before
+// @now, as long as we do not overcome the in-flight limit.
+//
+// The send timestamp of each request is its intended send time, not the
+// actual one. Hence, requests delayed because the client fell behind (or
+// because of the in-flight limit) account for the delay in their latency,
+// which corrects for coordinated omission.
+static bool
+cli_conn_send_open(struct cli_conf *conf, struct cli_conn *conn, uint64_t now) {
+    bool progress = false;
+
+    if (!cli_conn_flush(conn, &progress))
+        return progress;
+
+    while (conn->next_send <= now && cli_conn_can_queue(conf, conn)) {
+        cli_conn_queue(conf, conn, conn->next_send);
+        conn->next_send += cli_conn_interval(conf, conn);
+    }
+    cli_conn_flush(conn, &progress);
+
+    return progress;
+}
+
+// open-loop mode: default per-connection in-flight limit
+#define CLI_OPEN_DEFAULT_BURST 256
+
+// if the next send is further away than this, sleep in poll() instead of
+// spinning
+#define CLI_OPEN_SPIN_SECS 0.002
+
+// open-loop version of cli_ping_pong()
+//
+// Requests are sent at their scheduled times, independently of responses.
+// Sockets are non-blocking, and we spin (on the TSC and non-blocking recvs)
+// until the next send time, unless it is far enough away to sleep in poll().
+// With the spin wait strategy, or shm connections, we never sleep.
+static void
+cli_ping_pong_open(struct cli_conf *conf, struct cli_conn *conns, unsigned nconns,
+                   struct cli_lat *lat) {
+
+    struct pollfd *pfds = xcalloc(nconns, sizeof(*pfds));
+    const uint64_t spin_ticks = __tsc_secs2ticks(CLI_OPEN_SPIN_SECS);
+    const uint64_t msec_ticks = __tsc_secs2ticks(0.001);
+    unsigned ndone = 0;
+
+    // spread the first requests of the connections over an interval
+    uint64_t t0 = get_ticks();
+    for (unsigned i=0; i < nconns; i++)
+        conns[i].next_send = t0 + i*(conf->interval_ticks / nconns);
+
+    while (ndone < nconns) {
+        bool progress = false;
+        unsigned npfds = 0;
+        uint64_t next_send = UINT64_MAX;
+        uint64_t now = get_ticks();
+
+        ndone = 0;
+        for (unsigned i=0; i < nconns; i++) {
+            struct cli_conn *conn = &conns[i];
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            progress |= cli_conn_send_open(conf, conn, now);
+            progress |= cli_conn_recv(conf, conn, lat, false);
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            if (conn->sent < conf->nmessages)
+                next_send = MIN(next_send, conn->next_send);
+            if (conn->in_flight > 0) {
+                pfds[npfds].fd = conn->fd;
+                pfds[npfds].events = POLLIN | (conn->slen > 0 ? POLLOUT : 0);
+                npfds++;
+            }
+        }
+
+        if (progress || ndone == nconns)
+            continue;
+
+        now = get_ticks();
+        if (conf->wait == RR_WAIT_SPIN || conf->shm)
+            continue;
+        if (next_send == UINT64_MAX || next_send > now + spin_ticks) {
+            int timeout = -1;
+            if (next_send != UINT64_MAX)
+                timeout = (next_send - now - spin_ticks) / msec_ticks;
+            if (poll(pfds, npfds, timeout) == -1 && errno != EINTR)
+                die_perr("poll");
+        }
+    }
+
+    free(pfds);
+}
+
+// drive @nconns connections until all of them are done
+//
+// With the block (or busy-poll) wait strategy, a single connection blocks in
+// recv(), like the original client loop. Otherwise, and for multiple
+// connections, calls are non-blocking, and we poll() when none of the
+// connections made progress, or try again if we spin (or for shm connections,
+// which cannot be polled).
+static void
+cli_ping_pong(struct cli_conf *conf, struct cli_conn *conns, unsigned nconns,
+              struct cli_lat *lat) {
+
+    const bool may_block = (nconns == 1 && rr_wait_blocks(conf->wait));
+    struct pollfd *pfds = xcalloc(nconns, sizeof(*pfds));
+    unsigned ndone = 0;
+
+    while (ndone < nconns) {
+        bool progress = false;
+        unsigned npfds = 0;
+
+        ndone = 0;
+        for (unsigned i=0; i < nconns; i++) {
+            struct cli_conn *conn = &conns[i];
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            progress |= cli_conn_send(conf, conn);
+            progress |= cli_conn_recv(conf, conn, lat, may_block);
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            pfds[npfds].fd = conn->fd;
+            pfds[npfds].events = 0;
+            if (conn->in_flight > 0)
+                pfds[npfds].events |= POLLIN;
+            if (conn->slen > 0)
+                pfds[npfds].events |= POLLOUT;
+            npfds++;
+        }
+
+        if (!progress && npfds > 0 && conf->wait != RR_WAIT_SPIN && !conf->shm) {
+            if (poll(pfds, npfds, -1) == -1 && errno != EINTR)
+                die_perr("poll");
+        }
+    }
+
+    free(pfds);
+}
+
+/**
+ * UDP client
+ *
+ * Each request and each response is a single datagram, which might be lost,
+ * duplicated, or reordered. Requests are sent and responses are received in
+ * batches with sendmmsg()/recvmmsg(). The state of each request is kept in
+ * ->slots, indexed by rrid % CLI_UDP_WINDOW(burst). A request that is not
+ * answered within the timeout is counted as lost, which frees its in-flight
+ * slot, so lost datagrams do not stall the client.
+ */
+
+static inline bool
+cli_udp_can_queue(struct cli_conf *conf, struct cli_conn *conn) {
+    return cli_conn_can_queue(conf, conn) &&
+           conn->sent - conn->oldest < CLI_UDP_WINDOW(conf->burst);
+}
+
+// queue the next request, with send timestamp @stamp. @now is used for the
+// deadline, which is relative to the actual send time.
+static inline void
+cli_udp_queue(struct cli_conf *conf, struct cli_conn *conn, uint64_t stamp, uint64_t now) {
+    struct rr_hdr *req = (struct rr_hdr *)(conn->sbuf + conn->slen);
+    struct cli_udp_slot *s = &conn->slots[conn->sent % CLI_UDP_WINDOW(conf->burst)];
+
+    req->rrid = conn->sent;
+    conn->slen += conn->req_buff_size;
+    s->stamp = stamp;
+    s->deadline = now + conf->timeout_ticks;
+    s->rrid = conn->sent;
+    s->state = CLI_UDP_INFLIGHT;
+    conn->sent++;
+    conn->in_flight++;
+}
+
+// send queued requests, one datagram each, without blocking
+// returns true if everything was sent, and sets *@progress if anything was.
+static bool
+cli_udp_flush(struct cli_conn *conn, bool *progress) {
+    while (conn->soff < conn->slen) {
+        unsigned n = 0;
+        for (size_t off = conn->soff; off < conn->slen; off += conn->req_buff_size, n++) {
+            conn->iovs[n].iov_base = conn->sbuf + off;
+            conn->iovs[n].iov_len = conn->req_buff_size;
+            conn->msgs[n].msg_hdr = (struct msghdr) {
+                .msg_iov = &conn->iovs[n],
+                .msg_iovlen = 1,
+            };
+        }
+
+        int ret = sendmmsg(conn->fd, conn->msgs, n, MSG_DONTWAIT);
+        if (ret == -1) {
+            conn->errors++;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                return false;
+            // pending ICMP error for an earlier datagram: just retry
+            if (errno == ECONNREFUSED)
+                continue;
+            die_perr("sendmmsg");
+        }
+        conn->soff += ret*conn->req_buff_size;
+        *progress = true;
+    }
+
+    conn->slen = conn->soff = 0;
+    return true;
+}
+
+// send requests without blocking: as many as the in-flight limit allows, or,
+// in open-loop mode, the ones whose intended send time is before @now.
+// Returns true if anything was sent.
+static bool
+cli_udp_send(struct cli_conf *conf, struct cli_conn *conn, uint64_t now) {
+    bool progress = false;
+
+    if (!cli_udp_flush(conn, &progress))
+        return progress;
+
+    if (conf->rate > 0) {
+        while (conn->next_send <= now && cli_udp_can_queue(conf, conn)) {
+            cli_udp_queue(conf, conn, conn->next_send, now);
+            conn->next_send += cli_conn_interval(conf, conn);
+        }
+    } else {
+        while (cli_udp_can_queue(conf, conn))
+            cli_udp_queue(conf, conn, now, now);
+    }
+    cli_udp_flush(conn, &progress);
+
+    return progress;
+}
+
+// receive as many responses as possible, without blocking
+// returns true if any (new) response was received.
+static bool
+cli_udp_recv(struct cli_conf *conf, struct cli_conn *conn, struct cli_lat *lat) {
+    const unsigned window = CLI_UDP_WINDOW(conf->burst);
+    bool recv_one = false;
+
+    for (;;) {
+        for (unsigned i=0; i < CLI_UDP_BATCH; i++) {
+            conn->iovs[i].iov_base = conn->ubuf + i*conn->res_buff_size;
+            conn->iovs[i].iov_len = conn->res_buff_size;
+            conn->msgs[i].msg_hdr = (struct msghdr) {
+                .msg_iov = &conn->iovs[i],
+                .msg_iovlen = 1,
+            };
+        }
+
+        int n = recvmmsg(conn->fd, conn->msgs, CLI_UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            conn->errors++;
+            // server (not yet) there: the requests will time out
+            if (errno == ECONNREFUSED)
+                continue;
+            die_perr("recvmmsg");
+        }
+
+        uint64_t t = get_ticks();
+        for (int i=0; i < n; i++) {
+            struct rr_hdr *res = conn->iovs[i].iov_base;
+            struct msghdr *mh = &conn->msgs[i].msg_hdr;
+
+            if (conn->msgs[i].msg_len < sizeof(*res) || res->magic != RR_MAGIC)
+                die("invalid protocol");
+            // response to a retransmitted HELO
+            if (res->type == RR_TYPE_OHHI)
+                continue;
+            if (res->type != RR_TYPE_PONG || res->pong.dlen != conf->res_size ||
+                conn->msgs[i].msg_len != conn->res_buff_size || (mh->msg_flags & MSG_TRUNC))
+                die("invalid protocol");
+            if (res->rrid >= conn->sent)
+                die("unexpected rrid: %u (sent: %zd)\n", res->rrid, conn->sent);
+
+            // If the slot was reused, the request was resolved (answered or
+            // lost) before. We cannot tell which, so we count it as late.
+            struct cli_udp_slot *s = &conn->slots[res->rrid % window];
+            if (s->rrid != res->rrid || s->state == CLI_UDP_LOST) {
+                conn->late++;
+                continue;
+            } else if (s->state == CLI_UDP_ANSWERED) {
+                conn->duplicates++;
+                continue;
+            }
+
+            if (res->rrid < conn->rx_next)
+                conn->reordered++;
+            else
+                conn->rx_next = res->rrid + 1;
+
+            cli_lat_add(lat, t - s->stamp);
+            if (conn->trace)
+                cli_conn_trace(conf, conn, res->rrid, s->stamp, t, NULL);
+            s->state = CLI_UDP_ANSWERED;
+            recv_one = true;
+            conn->received++;
+            conn->in_flight--;
+        }
+
+        if (n < CLI_UDP_BATCH)
+            break;
+    }
+
+    return recv_one;
+}
+
+// count the requests whose deadline is before @now as lost, and advance
+// ->oldest past resolved requests. Requests are sent in rrid order, so
+// deadlines are too, and we can stop at the first one that has not expired.
+// Returns its deadline, or UINT64_MAX if nothing is in flight.
+static uint64_t
+cli_udp_expire(struct cli_conf *conf, struct cli_conn *conn, uint64_t now) {
+    const unsigned window = CLI_UDP_WINDOW(conf->burst);
+
+    for (; conn->oldest < conn->sent; conn->oldest++) {
+        struct cli_udp_slot *s = &conn->slots[conn->oldest % window];
+        if (s->state != CLI_UDP_INFLIGHT)
+            continue;
+        if (s->deadline > now)
+            return s->deadline;
+        s->state = CLI_UDP_LOST;
+        conn->lost++;
+        conn->in_flight--;
+    }
+
+    return UINT64_MAX;
+}
+
+// UDP version of cli_ping_pong() and cli_ping_pong_open()
+//
+// All calls are non-blocking. We poll() until the earliest request deadline
+// (or, in open-loop mode, the next send time) when no connection made
+// progress, unless the wait strategy is spin. The block strategy also polls,
+// because we cannot block past a deadline.
+static void
+cli_udp_ping_pong(struct cli_conf *conf, struct cli_conn *conns, unsigned nconns,
+                  struct cli_lat *lat) {
+
+    struct pollfd *pfds = xcalloc(nconns, sizeof(*pfds));
+    const uint64_t spin_ticks = __tsc_secs2ticks(CLI_OPEN_SPIN_SECS);
+    const uint64_t msec_ticks = __tsc_secs2ticks(0.001);
+    unsigned ndone = 0;
+
+    if (conf->rate > 0) {
+        uint64_t t0 = get_ticks();
+        for (unsigned i=0; i < nconns; i++)
+            conns[i].next_send = t0 + i*(conf->interval_ticks / nconns);
+    }
+
+    while (ndone < nconns) {
+        bool progress = false;
+        unsigned npfds = 0;
+        uint64_t next_send = UINT64_MAX, deadline = UINT64_MAX;
+
+        ndone = 0;
+        for (unsigned i=0; i < nconns; i++) {
+            struct cli_conn *conn = &conns[i];
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            progress |= cli_udp_send(conf, conn, get_ticks());
+            progress |= cli_udp_recv(conf, conn, lat);
+            // expired requests free up in-flight slots
+            size_t lost = conn->lost;
+            deadline = MIN(deadline, cli_udp_expire(conf, conn, get_ticks()));
+            progress |= (conn->lost != lost);
+            if (cli_conn_done(conf, conn)) {
+                ndone++;
+                continue;
+            }
+
+            if (conf->rate > 0 && conn->sent < conf->nmessages)
+                next_send = MIN(next_send, conn->next_send);
+            pfds[npfds].fd = conn->fd;
+            pfds[npfds].events = POLLIN | (conn->slen > 0 ? POLLOUT : 0);
+            npfds++;
+        }
+
+        if (progress || ndone == nconns)
+            continue;
+
+        uint64_t now = get_ticks();
+        if (conf->wait == RR_WAIT_SPIN)
+            continue;
+        if (next_send != UINT64_MAX && next_send <= now + spin_ticks)
+            continue;
+
+        int timeout = -1;
+        if (next_send != UINT64_MAX)
+            timeout = (next_send - now - spin_ticks) / msec_ticks;
+        if (deadline != UINT64_MAX) {
+            // round up, so that we do not spin until the deadline
+            int t = deadline <= now ? 0 : (deadline - now + msec_ticks - 1) / msec_ticks;
+            if (timeout == -1 || t < timeout)
+                timeout = t;
+        }
+        if (poll(pfds, npfds, timeout) == -1 && errno != EINTR)
+            die_perr("poll");
+    }
+
+    free(pfds);
+}
+
+// io_uring version of cli_ping_pong(), for a single connection
+//
+// Up to burst requests are written with a single WRITE_FIXED, and responses
+// are read with READ_FIXED into a buffer that can hold burst of them. Both
+// buffers are registered. There is at most one write and one read in flight.
+static void
+cli_uring_ping_pong(struct cli_conf *conf, struct cli_conn *conn,
+                    struct cli_lat *lat) {
+
+	const size_t nmessages = conf->nmessages;
+	const unsigned burst = conf->burst;
+	const int fd = conn->fd;
+	struct uring ring;
+	char *sbuf, *rbuf;
+	size_t slen, soff, rlen, rcap;
+	bool send_inflight, recv_inflight;
+	int err;
+
+	sbuf = xmalloc(burst*conn->req_buff_size);
+	rcap = burst*conn->res_buff_size;
+	rbuf = xmalloc(rcap);
+
+	rr_uring_init(&ring, conf->sqpoll);
+	struct iovec iovs[2] = {
+		{ .iov_base = sbuf, .iov_len = burst*conn->req_buff_size },
+		{ .iov_base = rbuf, .iov_len = rcap },
+	};
+	if ((err = uring_register_buffers(&ring, iovs, 2)) < 0)
+		die("uring_register_buffers: %s\n", strerror(-err));
+
+	slen = soff = rlen = 0;
+	send_inflight = recv_inflight = false;
+	while (conn->received < nmessages || send_inflight) {
+		if (!send_inflight && conn->in_flight < burst && conn->sent < nmessages) {
+			size_t n = MIN(burst - conn->in_flight, nmessages - conn->sent);
+			for (size_t i=0; i < n; i++) {
+				uint64_t t = get_ticks();
+				rr_msg_init(conf->v2, sbuf + i*conn->req_buff_size, RR_TYPE_PING, 0, conf->req_size);
+				rr_msg_set_ping(conf->v2, sbuf + i*conn->req_buff_size, conn->sent, t);
+				conn->sum1 += conn->sent;
+				conn->stamps[conn->sent % burst] = t;
+				conn->sent++;
+			}
+			slen = n*conn->req_buff_size;
+			soff = 0;
+			rr_uring_prep_fixed(&ring, IORING_OP_WRITE_FIXED, fd, sbuf, slen, 0, URING_UD_SEND);
+			send_inflight = true;
+			conn->in_flight += n;
+		}
+
+		// only read if responses are expected, so that no read is left
+		// pending when we are done.
+		if (!recv_inflight && conn->in_flight > 0) {
+			rr_uring_prep_fixed(&ring, IORING_OP_READ_FIXED, fd, rbuf + rlen, rcap - rlen, 1, URING_UD_RECV);
+			recv_inflight = true;
+		}
+
+		int res;
+		unsigned flags;
+		switch (rr_uring_wait(&ring, &res, &flags)) {
+			case URING_UD_SEND:
+			if (res < 0) {
+				errno = -res;
+				die_perr("send");
+			}
+			soff += res;
+			if (soff < slen) {
+				conn->errors++;
+				rr_uring_prep_fixed(&ring, IORING_OP_WRITE_FIXED, fd, sbuf + soff, slen - soff, 0, URING_UD_SEND);
+			} else {
+				send_inflight = false;
+			}
+			break;
+
+			case URING_UD_RECV: {
+			recv_inflight = false;
+			if (res < 0) {
+				errno = -res;
+				die_perr("recv");
+			} else if (res == 0) {
+				die("connection closed by server\n");
+			}
+			rlen += res;
+
+			uint64_t now = get_ticks();
+			size_t off;
+			for (off = 0; rlen - off >= conn->res_buff_size; off += conn->res_buff_size) {
+				void *res_msg = rbuf + off;
+				if (!rr_msg_is(conf->v2, res_msg, RR_TYPE_PONG) ||
+				    rr_msg_dlen(conf->v2, res_msg) != conf->res_size)
+					die("invalid protocol");
+				uint64_t rrid = rr_msg_rrid(conf->v2, res_msg);
+				if (rrid >= conn->sent || conn->sent - rrid > burst)
+					die("unexpected rrid: %" PRIu64 " (sent: %zd)\n", rrid, conn->sent);
+				cli_lat_add(lat, now - conn->stamps[rrid % burst]);
+				if (conn->trace)
+					cli_conn_trace(conf, conn, rrid, conn->stamps[rrid % burst], now, NULL);
+				conn->received++;
+				conn->sum2 += rrid;
+				conn->in_flight--;
+			}
+			rlen -= off;
+			memmove(rbuf, rbuf + off, rlen);
+			break;
+			}
+
+			default:
+			die("unexpected io_uring completion\n");
+		}
+	}
+
+	uring_exit(&ring);
+	free(sbuf);
+	free(rbuf);
+	return;
+}
+
+static int
+cli_connect(struct cli_conf *conf) {
+    unsigned connect_errs=10;
+    int fd;
+
+	for (unsigned i=0; ;) {
+	    fd = ai_connect(conf->connect_ai, NULL);
+	    if (fd != -1)
+	        break;
+        perror("connect");
+	    if (++i == connect_errs)
+	        die("bailing out after %d connection attempts\n", connect_errs);
+	}
 
-    printf("connection from: %s//%s:%s\n", cli_url->prot, cli_url->node, cli_url->serv);
+	return fd;
+}
 
-	nreceived = recv(fd, &rr_msg, sizeof(rr_msg), 0);
-	if (nreceived != sizeof(rr_msg))
-	    die_perr("recv");
+// client threads share nothing: each one drives its own connections, and
+// records latencies on its own ->lat, whose cumulative histograms are merged
+// at the end. The only exception is the interval handoff with the reporter
+// (see struct cli_ival).
+struct cli_conn_totals {
+    size_t sent, received;
+};
 
-    if (rr_msg.magic != RR_MAGIC || rr_msg.type != RR_TYPE_HELO)
-        die("invalid protocol");
+struct cli_thread {
+    pthread_t tid;
+    unsigned id;
+    unsigned nconns;
+    unsigned conn0; // index of the first connection (over all threads)
+    struct cli_conf *conf;
+    struct cli_lat lat;
+    struct cli_ival ival;
+    bool done;
+    // totals over the thread's connections (errors: failed send/recv calls,
+    // including EAGAIN ones, and the rest for UDP)
+    size_t sent, received, errors, lost, late, duplicates, reordered;
+    // MSG_ZEROCOPY: completed sends, and how many the kernel copied
+    size_t zc_sends, zc_copied;
+    // per-connection totals
+    struct cli_conn_totals *conn_totals;
+    // ticks when the thread started and finished running its connections
+    // (after the HELOs)
+    uint64_t t_start, t_end;
+};
 
-    unsigned req_size = rr_msg.helo.req_size;
-    unsigned res_size = rr_msg.helo.res_size;
-    printf("%s//%s:%s: req_size:%u res_size:%u\n", cli_url->prot, cli_url->node, cli_url->serv, req_size, res_size);
+// run time of the client threads, from the first start to the last end
+static double
+cli_threads_secs(struct cli_conf *conf, struct cli_thread *thrs) {
+    uint64_t start = UINT64_MAX, end = 0;
+    for (unsigned i=0; i < conf->nthreads; i++) {
+        start = MIN(start, thrs[i].t_start);
+        end = MAX(end, thrs[i].t_end);
+    }
+    return end > start ? __tsc_getsecs(end - start) : 0.0;
+}
 
-    rr_msg.type = RR_TYPE_OHHI;
-    nsent = send(fd, &rr_msg, sizeof(rr_msg), 0);
-	if (nsent != sizeof(rr_msg))
-	    die_perr("sent");
+static void
+cli_run(struct cli_thread *thr) {
+    struct cli_conf *conf = thr->conf;
+    struct cli_conn *conns = xcalloc(thr->nconns, sizeof(*conns));
+    int *fds = xcalloc(thr->nconns, sizeof(*fds));
 
-    req_buff_size = req_size + sizeof(struct rr_hdr);
-	req = xmalloc(req_buff_size);
+    for (unsigned i=0; i < thr->nconns; i++) {
+        fds[i] = cli_connect(conf);
+        if (conf->shm)
+            rr_shm_connect(fds[i], conf->wait == RR_WAIT_SPIN);
+    }
 
-    res_buff_size = res_size + sizeof(struct rr_hdr);
-	res = xmalloc(res_buff_size);
-	rr_init_pong(res, 0, res_size);
+    // in sweep and SLO search modes, each iteration runs a point over the
+    // same connections, renegotiated with a new HELO
+    for (;;) {
+        if (conf->points_barrier) {
+            pthread_barrier_wait(conf->points_barrier);
+            if (conf->points_done)
+                break;
+        }
 
+        for (unsigned i=0; i < thr->nconns; i++) {
+            uint64_t srv_khz = 0;
+            cli_helo(conf, fds[i], &srv_khz);
+            cli_conn_init(conf, &conns[i], fds[i], srv_khz);
+            conns[i].idx = thr->conn0 + i;
+            if (conf->trace) {
+                conns[i].trace = trace_conn_recs(conf->trace, conns[i].idx);
+                // all connections are to the same server
+                if (srv_khz)
+                    conf->trace->hdr->srv_khz = srv_khz;
+            }
+        }
 
-    for (count = 0;;) {
-        nreceived = recv(fd, req, req_buff_size, 0);
-        if (nreceived == -1)
-            die_perr("recv");
-        else if (nreceived == 0)
+        thr->t_start = get_ticks();
+        switch (conf->mode) {
+            case CLI_MODE_SYSCALL:
+            if (conf->udp)
+                cli_udp_ping_pong(conf, conns, thr->nconns, &thr->lat);
+            else if (conf->rate > 0)
+                cli_ping_pong_open(conf, conns, thr->nconns, &thr->lat);
+            else
+                cli_ping_pong(conf, conns, thr->nconns, &thr->lat);
             break;
-        else if (nreceived != (int)req_buff_size)
-            die("received less than expected");
-        else if (req->magic != RR_MAGIC || req->type != RR_TYPE_PING)
-            die("invalid protocol");
 
-        res->rrid = req->rrid;
+            case CLI_MODE_URING:
+            assert(thr->nconns == 1);
+            cli_uring_ping_pong(conf, &conns[0], &thr->lat);
+            break;
+        }
+        thr->t_end = get_ticks();
 
-        nsent = send(fd, res, res_buff_size, 0);
-        if (nsent != (int)res_buff_size)
-            die_perr("send");
-        count++;
+        for (unsigned i=0; i < thr->nconns; i++) {
+            struct cli_conn *conn = &conns[i];
+            thr->sent += conn->sent;
+            thr->received += conn->received;
+            thr->errors += conn->errors;
+            thr->lost += conn->lost;
+            thr->late += conn->late;
+            thr->duplicates += conn->duplicates;
+            thr->reordered += conn->reordered;
+            thr->conn_totals[i].sent += conn->sent;
+            thr->conn_totals[i].received += conn->received;
+            if (conn->zc) {
+                rr_zc_drain(conn->zc);
+                thr->zc_sends += conn->zc->nsends;
+                thr->zc_copied += conn->zc->ncopied;
+            }
+            cli_conn_fini(conn);
+        }
+
+        if (!conf->points_barrier)
+            break;
+        pthread_barrier_wait(conf->points_barrier);
     }
 
-    printf("done with: %s//%s:%s (served %zd messages)\n", cli_url->prot, cli_url->node, cli_url->serv, count);
-    close(fd);
+    for (unsigned i=0; i < thr->nconns; i++) {
+        rr_shm_close(fds[i]);
+        close(fds[i]);
+    }
+    free(fds);
+    free(conns);
 }
 
-int
-main_srv(const char *pname, int argc, char *argv[]) {
-
-    struct addrinfo *ai_list, *ai_b;
-    struct url srv_url;
-    int lfd;
+static void *
+cli_thread(void *arg) {
+    struct cli_thread *thr = arg;
+    int cpu;
 
-    if (argc < 2) {
-        printf("Usage: %s srv <server address>\nn", pname);
-        exit(1);
+    if (thr->conf->nthreads > 1) {
+        cpu = pin_self_nth_cpu(thr->id);
+        fprintf(cli_diag(thr->conf), "client thread %u: cpu:%d connections:%u\n", thr->id, cpu, thr->nconns);
     }
+    cli_run(thr);
+    __atomic_store_n(&thr->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
 
-    if (url_parse(&srv_url, argv[1]) < 0)
-        die("cannot parse URL:%s\n", argv[1]);
+// how long the reporter waits for client threads to acknowledge an interval
+// swap. A thread that does not record anything in that time (e.g., because it
+// waits for a slow response) has its samples reported in a later interval.
+#define CLI_IVAL_ACK_SECS 0.01
 
-    ai_list = url_getaddrinfo(&srv_url, true);
-    lfd = ai_bind(ai_list, &ai_b);
+// reporter loop for interval reporting: runs until all client threads are done
+static void
+cli_report_intervals(struct cli_conf *conf, struct cli_thread *thrs) {
+    struct hist *h = xmalloc(sizeof(struct hist));
+    double t_prev = cli_now_secs();
 
-    int o = 1;
-    if (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &o, sizeof(o)) == -1)
-        die_perr("setsockopt");
+    for (unsigned idx = 1; ; idx++) {
+        struct timespec ts;
+        double t_next = t_prev + conf->interval_secs;
+        ts.tv_sec = (time_t)t_next;
+        ts.tv_nsec = (long)((t_next - ts.tv_sec) * 1e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
 
-    if (listen(lfd, 5) == -1)
-        die_perr("listen");
+        // ask for a swap, unless the previous one is still pending. A swap
+        // acknowledged after we stopped waiting for it has its ->full
+        // collected first (into this interval), so that the client thread
+        // always has a ->spare to switch to.
+        hist_init(h);
+        for (unsigned i=0; i < conf->nthreads; i++) {
+            struct cli_ival *ival = &thrs[i].ival;
+            if (__atomic_load_n(&ival->ack, __ATOMIC_ACQUIRE) != ival->req)
+                continue;
+            if (ival->full) {
+                hist_merge(h, ival->full);
+                hist_init(ival->full);
+                ival->spare = ival->full;
+                ival->full = NULL;
+            }
+            __atomic_store_n(&ival->req, idx, __ATOMIC_RELEASE);
+        }
 
-    for (;;) {
-        struct url cli_url;
-        struct sockaddr_storage cli_addr;
-        socklen_t cli_addr_size = sizeof(cli_addr);
-        int afd = accept(lfd, (struct sockaddr *)&cli_addr, &cli_addr_size);
-        if (afd == -1)
-            die_perr("accept");
+        bool all_done = true;
+        double t_wait = cli_now_secs() + CLI_IVAL_ACK_SECS;
+        for (unsigned i=0; i < conf->nthreads; i++) {
+            struct cli_thread *thr = &thrs[i];
+            struct cli_ival *ival = &thr->ival;
+            bool done, acked;
+            for (;;) {
+                done = __atomic_load_n(&thr->done, __ATOMIC_ACQUIRE);
+                acked = __atomic_load_n(&ival->ack, __ATOMIC_ACQUIRE) == ival->req;
+                if (acked || done || cli_now_secs() > t_wait)
+                    break;
+                usleep(100);
+            }
+            all_done &= done;
 
-        if (url_from_peer(&cli_url, afd, (struct sockaddr *)&cli_addr, cli_addr_size) < 0)
-            die("url_from_peer failed");
-        srv_serve(&cli_url, afd);
+            // the client thread does not touch ->full and ->spare after it
+            // acknowledges, until we make another request.
+            if (acked && ival->full) {
+                hist_merge(h, ival->full);
+                hist_init(ival->full);
+                ival->spare = ival->full;
+                ival->full = NULL;
+            }
+
+            // a thread that is done, will not swap again
+            if (done) {
+                hist_merge(h, ival->cur);
+                hist_init(ival->cur);
+            }
+        }
+
+        double t = cli_now_secs();
+        if (conf->out_fmt == CLI_OUT_TEXT) {
+            report_interval(idx, t - t_prev, h);
+        } else {
+            struct cli_record rec = { .type = "interval", .idx = idx, .secs = t - t_prev, .h = h };
+            cli_out_record(conf, &rec);
+        }
+        t_prev = t;
+        if (all_done)
+            break;
     }
 
-    return 0;
+    free(h);
 }
 
 /**
- * Client
+ * Sweep mode (-S)
+ *
+ * Runs nmessages requests per connection for each point of a sweep (e.g.,
+ * -S burst=1,2,4 -S req=0,64), and reports each point on its own. All points
+ * run over the same connections: before each point, every connection sends
+ * a new HELO with the point's sizes (RR_OPT_SWEEP), so there is no connection
+ * setup or slow start between points.
  */
 
-struct cli_conf {
-    unsigned burst;
-    unsigned nmessages;
-    unsigned req_size, res_size;
-    struct url srv_url;
+static const char *cli_sweep_names[CLI_SWEEP_NPARAMS] = {
+    [CLI_SWEEP_BURST] = "burst",
+    [CLI_SWEEP_REQ]   = "req",
+    [CLI_SWEEP_RES]   = "res",
 };
 
+// parse a <param>=<v1>,<v2>,... sweep
 static void
-cli_helo(struct cli_conf *conf, int fd) {
+cli_sweep_parse(struct cli_conf *conf, const char *str) {
+    const char *eq = strchr(str, '=');
+    struct cli_sweep *sw = &conf->sweep[conf->nsweep];
+    unsigned p;
 
-    struct rr_hdr rr_helo, rr_ohhi;
-    unsigned helo_errs=0; // NB: should be >0 for UDP
+    for (p=0; p < CLI_SWEEP_NPARAMS; p++) {
+        if (eq && strlen(cli_sweep_names[p]) == (size_t)(eq - str) &&
+            strncmp(str, cli_sweep_names[p], eq - str) == 0)
+            break;
+    }
+    if (p == CLI_SWEEP_NPARAMS)
+        die("invalid sweep: %s (expecting burst|req|res=<values>)\n", str);
+    for (unsigned i=0; i < conf->nsweep; i++) {
+        if (conf->sweep[i].param == p)
+            die("parameter swept twice: %s\n", cli_sweep_names[p]);
+    }
 
-    rr_init_helo(&rr_helo, conf->req_size, conf->res_size);
+    sw->param = p;
+    sw->nvals = 0;
+    sw->vals = NULL;
+    for (const char *v = eq + 1; ; ) {
+        char *end;
+        unsigned long val = strtoul(v, &end, 0);
+        if (end == v || (*end != ',' && *end != '\0') || val > UINT32_MAX)
+            die("invalid sweep value: %s\n", v);
+        if (p == CLI_SWEEP_BURST && val < 1)
+            die("burst specified is < 1\n");
+        sw->vals = xrealloc(sw->vals, (sw->nvals + 1)*sizeof(*sw->vals));
+        sw->vals[sw->nvals++] = val;
+        if (*end == '\0')
+            break;
+        v = end + 1;
+    }
+    conf->nsweep++;
+}
 
-	for (unsigned i=0; ;) {
-        int nsent = send(fd, &rr_helo, sizeof(rr_helo), 0);
-		if (nsent == sizeof(rr_helo)) {
+static unsigned
+cli_sweep_npoints(struct cli_conf *conf) {
+    unsigned n = 1;
+    for (unsigned i=0; i < conf->nsweep; i++)
+        n *= conf->sweep[i].nvals;
+    return n;
+}
+
+// largest value of @param over the sweep, or @dflt if it is not swept
+static unsigned
+cli_sweep_max(struct cli_conf *conf, enum cli_sweep_param param, unsigned dflt) {
+    for (unsigned i=0; i < conf->nsweep; i++) {
+        if (conf->sweep[i].param != param)
+            continue;
+        unsigned max = 0;
+        for (unsigned j=0; j < conf->sweep[i].nvals; j++)
+            max = MAX(max, conf->sweep[i].vals[j]);
+        return max;
+    }
+    return dflt;
+}
+
+// configure @conf for point @point
+static void
+cli_sweep_set(struct cli_conf *conf, unsigned point) {
+    for (unsigned i=conf->nsweep; i-- > 0; ) {
+        struct cli_sweep *sw = &conf->sweep[i];
+        unsigned val = sw->vals[point % sw->nvals];
+        point /= sw->nvals;
+        switch (sw->param) {
+            case CLI_SWEEP_BURST:
+            conf->burst = val;
+            break;
+
+            case CLI_SWEEP_REQ:
+            conf->req_size = val;
+            break;
+
+            case CLI_SWEEP_RES:
+            conf->res_size = val;
             break;
+
+            case CLI_SWEEP_NPARAMS:
+            abort();
         }
-        perror("send");
-	    if (++i == helo_errs)
-	        die("bailing out after %d helo attempts\n", helo_errs);
-	}
+    }
+}
 
-	int nreceived = recv(fd, &rr_ohhi, sizeof(rr_ohhi), 0);
-	if (nreceived != sizeof(rr_ohhi))
-	    die_perr("recv");
+static void
+cli_lat_reset(struct cli_lat *lat) {
+    struct hist *hs[] = { lat->cum, lat->srv, lat->net, lat->ktx, lat->kwire, lat->krx, lat->knic };
+    for (size_t i=0; i < sizeof(hs) / sizeof(hs[0]); i++) {
+        if (hs[i])
+            hist_init(hs[i]);
+    }
+    lat->kts_missing = 0;
+}
 
-    if (rr_ohhi.magic != RR_MAGIC || rr_ohhi.type != RR_TYPE_OHHI)
-        die("invalid protocol");
+// start the client threads for a sequence of points (sweep or SLO search):
+// they connect, and wait on @barrier for the first point
+static void
+cli_points_start(struct cli_conf *conf, struct cli_thread *thrs, pthread_barrier_t *barrier) {
+    if ((errno = pthread_barrier_init(barrier, NULL, conf->nthreads + 1)) != 0)
+        die_perr("pthread_barrier_init");
+    conf->points_barrier = barrier;
+    conf->points_done = false;
+    for (unsigned i=0; i < conf->nthreads; i++)
+        xpthread_create(&thrs[i].tid, NULL, cli_thread, &thrs[i]);
 }
 
+// run a point with the current configuration of @conf, and fill @rec with its
+// results. @lat holds the merged latencies of the point (@rec points to it),
+// and the per-thread latencies and totals are reset for the next point.
+static void
+cli_points_run(struct cli_conf *conf, struct cli_thread *thrs, struct cli_lat *lat, struct cli_record *rec) {
+    // threads wait on the barrier, so they see the new configuration
+    double cpu = rr_cpu_secs(RUSAGE_SELF);
+    pthread_barrier_wait(conf->points_barrier);
+    pthread_barrier_wait(conf->points_barrier);
 
-static int
-comp_ticks(const void *t1p, const void *t2p) {
-    uint64_t t1 = *((const uint64_t *)t1p);
-    uint64_t t2 = *((const uint64_t *)t2p);
+    rec->h = lat->cum;
+    rec->lat = lat;
+    rec->totals = true;
+    rec->secs = cli_threads_secs(conf, thrs);
+    rec->cpu_secs = rr_cpu_secs(RUSAGE_SELF) - cpu;
+    rec->sent = rec->received = rec->errors = rec->lost = 0;
+    rec->req_bytes = rec->res_bytes = 0;
+    cli_lat_reset(lat);
+    for (unsigned i=0; i < conf->nthreads; i++) {
+        struct cli_thread *thr = &thrs[i];
+        cli_lat_merge(lat, &thr->lat);
+        cli_lat_reset(&thr->lat);
+        rec->sent += thr->sent;
+        rec->received += thr->received;
+        rec->errors += thr->errors;
+        rec->lost += thr->lost;
+        rec->req_bytes += thr->sent * conf->req_size;
+        rec->res_bytes += thr->received * conf->res_size;
+        thr->sent = thr->received = thr->errors = thr->lost = 0;
+        thr->late = thr->duplicates = thr->reordered = 0;
+        thr->zc_sends = thr->zc_copied = 0;
+        memset(thr->conn_totals, 0, thr->nconns * sizeof(*thr->conn_totals));
+    }
+}
 
-    if (t1 < t2)
-        return -1;
-    else if (t1 == t2)
-        return 0;
-    else
-        return 1;
+static void
+cli_points_stop(struct cli_conf *conf, struct cli_thread *thrs) {
+    conf->points_done = true;
+    pthread_barrier_wait(conf->points_barrier);
+    for (unsigned i=0; i < conf->nthreads; i++)
+        xpthread_join(thrs[i].tid, NULL);
+    pthread_barrier_destroy(conf->points_barrier);
+    conf->points_barrier = NULL;
 }
 
+// run all the points of the sweep with the client threads, and report each one
 static void
-report_ticks(uint64_t *ticks, size_t nticks) {
-    qsort(ticks, nticks, sizeof(uint64_t), comp_ticks);
+cli_sweep_run(struct cli_conf *conf, struct cli_thread *thrs) {
+    const unsigned npoints = cli_sweep_npoints(conf);
+    pthread_barrier_t barrier;
+    struct cli_lat lat;
 
-    uint64_t med;
-    size_t mid = nticks / 2;
-    if (nticks % 2 == 0) {
-        med = (ticks[mid] + ticks[mid-1]) / 2;
-    } else {
-        med = ticks[mid];
+    cli_lat_init(&lat, NULL, conf);
+    cli_points_start(conf, thrs, &barrier);
+    for (unsigned p=0; p < npoints; p++) {
+        struct cli_record rec = { .type = "point", .idx = p + 1 };
+        cli_sweep_set(conf, p);
+        cli_points_run(conf, thrs, &lat, &rec);
+        if (conf->out_fmt == CLI_OUT_TEXT) {
+            printf("SWEEP %u: burst:%u req_size:%u res_size:%u ", p + 1, conf->burst, conf->req_size, conf->res_size);
+            report_hist_line(rec.secs, lat.cum);
+        } else {
+            cli_out_record(conf, &rec);
+        }
     }
+    cli_points_stop(conf, thrs);
+    cli_lat_fini(&lat);
+}
 
-    uint64_t sum = 0;
-    for (size_t i=0; i < nticks; i++) {
-        sum += ticks[i];
-    }
-    uint64_t avg = sum / nticks;
-    uint64_t max = ticks[nticks - 1];
-    uint64_t min = ticks[0];
+/**
+ * SLO search (-L)
+ *
+ * Finds the highest open-loop rate that the server sustains while a latency
+ * percentile stays within an SLO. Each step runs a short open-loop window at
+ * a given rate (a point, see the sweep mode above), and checks the percentile
+ * against the SLO. The rate doubles until a step fails (or halves until one
+ * passes), and is then binary searched between the highest passing and the
+ * lowest failing rates.
+ *
+ * Latencies are measured from the intended send times, so a rate the server
+ * cannot sustain shows up as (growing) latency.
+ */
 
-    printf("TICKS: avg:%lu (%lf usecs) med:%lu (%lf usecs) min:%lu (%lf usecs) max:%lu (%lf usecs)\n",
-            avg, __tsc_getusecs(avg),
-            med, __tsc_getusecs(med),
-            min, __tsc_getusecs(min),
-            max, __tsc_getusecs(max));
-}
+// initial rate, if -r is not given
+#define CLI_SLO_START_RATE  1000.0
+// minimum number of requests per step, so that percentiles are meaningful,
+// unless that makes the step longer than CLI_SLO_MAX_STRETCH times its duration
+#define CLI_SLO_MIN_SAMPLES 1000
+#define CLI_SLO_MAX_STRETCH 4
+// stop ramping down below this rate
+#define CLI_SLO_MIN_RATE    10.0
+// stop the binary search when the interval is within this fraction of the
+// highest passing rate
+#define CLI_SLO_PRECISION   0.02
+#define CLI_SLO_MAX_STEPS   64
+#define CLI_SLO_DEFAULT_SECS 1.0
+
+struct cli_slo_step {
+    double rate, achieved;
+    uint64_t pct_ticks;
+    bool pass;
+};
 
+// parse a <pct>:<usecs>[:<secs>] SLO
 static void
-cli_ping_pong(struct cli_conf *conf, int fd) {
+cli_slo_parse(struct cli_conf *conf, const char *str) {
+    char *end;
 
-	size_t errors, sent, received;
-	const size_t nmessages = conf->nmessages;
-	size_t req_buff_size, res_buff_size;
-	const int burst = conf->burst;
-	struct rr_hdr *req, *res;
-	int in_flight;
-	uint32_t idx = 0;
-	uint32_t sum1, sum2;
-	uint64_t *ticks;
-
-	req_buff_size = sizeof(struct rr_hdr) + conf->req_size;
-	req = xmalloc(req_buff_size);
-	rr_init_ping(req, idx, conf->req_size);
-
-	res_buff_size = sizeof(struct rr_hdr) + conf->res_size;
-	res = xmalloc(res_buff_size);
-
-    ticks = xcalloc(nmessages, sizeof(uint64_t));
-
-	sum1 = sum2 = 0;
-	in_flight = errors = received = sent = 0;
-	while (received < nmessages) {
-        // try to send as many as possible without blocking or overcomming the
-        // in-flight limit
-		while ((in_flight < burst) && (nmessages >= sent)) {
-			req->rrid = idx;
-			//printf("SENDING %u\n", req->rrid);
-			int ret = send(fd, req, req_buff_size, MSG_DONTWAIT);
-			if (ret == -1) {
-				errors++;
-				if (errno == EAGAIN || errno == EWOULDBLOCK)
-					break;
-			    die_perr("send");
-			} else if (ret != (int)req_buff_size) {
-				die("Unexpected ret: %d (expecting:%zd)\n", ret, req_buff_size);
-			}
+    conf->slo_pct = strtod(str, &end);
+    if (end == str || *end != ':' || conf->slo_pct <= 0 || conf->slo_pct > 100)
+        die("invalid SLO: %s (expecting <pct>:<usecs>[:<secs>])\n", str);
+    str = end + 1;
+    conf->slo_usecs = strtod(str, &end);
+    if (end == str || (*end != ':' && *end != '\0') || conf->slo_usecs <= 0)
+        die("invalid SLO latency: %s\n", str);
+    if (*end == '\0')
+        return;
+    str = end + 1;
+    conf->slo_secs = strtod(str, &end);
+    if (end == str || *end != '\0' || conf->slo_secs <= 0)
+        die("invalid SLO step duration: %s\n", str);
+}
 
-			sum1 += idx;
-			in_flight++;
-			ticks[idx] = get_ticks();
-			idx++;
-		}
-		// try to receive as many as possible
-		bool recv_one = false;
-		while (in_flight > 0) {
-
-			// do not block if there are more messages we can send
-			int noblock = ( (nmessages > sent) && recv_one) ? MSG_DONTWAIT : 0;
-
-			int ret = recv(fd, res, res_buff_size, noblock);
-			if (ret == -1) {
-				errors++;
-				if (noblock && (errno == EAGAIN || errno == EWOULDBLOCK))
-					break;
-				die_perr("recv");
-			}
+// configure @conf for a step at @rate. Returns false if the rate is too high
+// for the TSC resolution.
+static bool
+cli_slo_set(struct cli_conf *conf, double rate) {
+    uint64_t interval = __tsc_secs2ticks((double)conf->nconns / rate);
+    if (interval == 0)
+        return false;
+    double n = MAX(rate * conf->slo_secs, CLI_SLO_MIN_SAMPLES);
+    n = MIN(n, rate * conf->slo_secs * CLI_SLO_MAX_STRETCH);
+    n = MAX(n / conf->nconns, 1);
+    conf->rate = rate;
+    conf->interval_ticks = interval;
+    conf->nmessages = (unsigned)MIN(ceil(n), UINT32_MAX);
+    return true;
+}
 
-            if (res->magic != RR_MAGIC || res->type != RR_TYPE_PONG || res->pong.dlen != conf->res_size)
-                die("invalid protocol");
+static int
+cli_slo_step_cmp(const void *a, const void *b) {
+    const struct cli_slo_step *x = a, *y = b;
+    return (x->rate > y->rate) - (x->rate < y->rate);
+}
 
-			recv_one = true;
-			received++;
-			sum2 += res->rrid;
-			ticks[req->rrid] = get_ticks() - ticks[req->rrid];
-			in_flight--;
-		}
-	}
+// run the SLO search with the client threads, and report each step, the
+// highest passing rate (the knee), and the latency/rate curve
+static void
+cli_slo_run(struct cli_conf *conf, struct cli_thread *thrs) {
+    struct cli_slo_step steps[CLI_SLO_MAX_STEPS];
+    const uint64_t slo_ticks = __tsc_secs2ticks(conf->slo_usecs / 1e6);
+    pthread_barrier_t barrier;
+    struct cli_lat lat, knee_lat;
+    struct cli_record knee = { .type = "knee" };
+    double lo = 0, hi = 0; // highest passing, and lowest failing rates
+    double rate = conf->rate;
+    unsigned nsteps = 0;
+
+    cli_lat_init(&lat, NULL, conf);
+    cli_lat_init(&knee_lat, NULL, conf);
+    cli_points_start(conf, thrs, &barrier);
+    while (nsteps < CLI_SLO_MAX_STEPS) {
+        if (!cli_slo_set(conf, rate)) {
+            fprintf(stderr, "SLO: rate %.1f too high, stopping\n", rate);
+            break;
+        }
 
-	if (sum1 != sum2)
-		die("checksum failed: %ul =/= %ul\n", sum1, sum2);
+        struct cli_slo_step *step = &steps[nsteps++];
+        struct cli_record rec = { .type = "step", .idx = nsteps };
+        cli_points_run(conf, thrs, &lat, &rec);
+        step->rate = rate;
+        step->achieved = lat.cum->count / rec.secs;
+        step->pct_ticks = hist_percentile(lat.cum, conf->slo_pct);
+        step->pass = step->pct_ticks <= slo_ticks;
+        if (conf->out_fmt == CLI_OUT_TEXT) {
+            printf("SLO STEP %u: rate:%.1f p%g:%.3lf %s ", nsteps, rate, conf->slo_pct,
+                   __tsc_getusecs(step->pct_ticks), step->pass ? "pass" : "fail");
+            report_hist_line(rec.secs, lat.cum);
+        } else {
+            cli_out_record(conf, &rec);
+        }
 
-	report_ticks(ticks, nmessages);
-	free(ticks);
+        if (step->pass) {
+            lo = rate;
+            knee = rec;
+            knee.type = "knee";
+            knee.lat = &knee_lat;
+            knee.h = knee_lat.cum;
+            cli_lat_reset(&knee_lat);
+            cli_lat_merge(&knee_lat, &lat);
+        } else {
+            hi = rate;
+        }
 
-	free(req);
-	free(res);
-	return;
+        if (hi == 0) {
+            rate *= 2;
+        } else if (lo == 0) {
+            rate /= 2;
+            if (rate < CLI_SLO_MIN_RATE)
+                break;
+        } else {
+            if (hi - lo <= lo * CLI_SLO_PRECISION)
+                break;
+            rate = (lo + hi) / 2;
+        }
+    }
+    cli_points_stop(conf, thrs);
+
+    if (lo > 0 && conf->out_fmt != CLI_OUT_TEXT) {
+        // the configuration of the knee step (rate, nmessages) for its record
+        cli_slo_set(conf, lo);
+        cli_out_record(conf, &knee);
+    } else if (conf->out_fmt == CLI_OUT_TEXT) {
+        qsort(steps, nsteps, sizeof(steps[0]), cli_slo_step_cmp);
+        printf("SLO CURVE: rate achieved p%g (usecs)\n", conf->slo_pct);
+        for (unsigned i=0; i < nsteps; i++)
+            printf("  %12.1f %12.1f %12.3lf%s\n", steps[i].rate, steps[i].achieved,
+                   __tsc_getusecs(steps[i].pct_ticks), steps[i].pass ? "" : " (fail)");
+        if (lo > 0)
+            printf("SLO: p%g <= %g usecs: max rate:%.1f reqs/sec (achieved:%.1f) in [%.1f, %.1f)\n",
+                   conf->slo_pct, conf->slo_usecs, lo, knee_lat.cum->count / knee.secs, lo, hi > 0 ? hi : INFINITY);
+        else
+            printf("SLO: p%g <= %g usecs: not met at any rate\n", conf->slo_pct, conf->slo_usecs);
+    }
+
+    cli_lat_fini(&knee_lat);
+    cli_lat_fini(&lat);
 }
 
+// human-readable report of a run, over all client threads (@lat: merged
+// latencies, @wall and @cpu: run time and CPU time in seconds)
 static void
-cli_run(struct cli_conf *conf, int fd) {
-    cli_helo(conf, fd);
-    cli_ping_pong(conf, fd);
+cli_report_text(struct cli_conf *conf, struct cli_thread *thrs, struct cli_lat *lat, double wall, double cpu) {
+    report_ticks(lat->cum);
+
+    if (conf->srv_tstamps) {
+        report_percentiles("SERVER", lat->srv);
+        report_percentiles("NETWORK", lat->net);
+    }
+
+    if (conf->kts) {
+        report_percentiles("KERNEL-TX", lat->ktx);
+        report_percentiles("KERNEL-WIRE", lat->kwire);
+        report_percentiles("KERNEL-RX", lat->krx);
+        if (lat->knic->count > 0)
+            report_percentiles("NIC", lat->knic);
+        printf("KERNEL: missing timestamps:%zd\n", lat->kts_missing);
+    }
+
+    // throughput and goodput (payload bytes of the requests sent, and of the
+    // responses received) over the run time of the threads
+    double secs = cli_threads_secs(conf, thrs);
+    size_t responses = 0, req_bytes = 0, res_bytes = 0;
+    for (unsigned i=0; i < conf->nthreads; i++) {
+        struct cli_thread *thr = &thrs[i];
+        double thr_secs = __tsc_getsecs(thr->t_end - thr->t_start);
+        responses += thr->received;
+        req_bytes += thr->sent * conf->req_size;
+        res_bytes += thr->received * conf->res_size;
+        for (unsigned j=0; conf->nconns > 1 && j < thr->nconns; j++) {
+            struct cli_conn_totals *ct = &thr->conn_totals[j];
+            printf("CONN %u: sent:%zd received:%zd reqs/sec:%.1f req_bytes:%zd res_bytes:%zd\n",
+                   thr->conn0 + j, ct->sent, ct->received, thr_secs > 0 ? ct->received / thr_secs : 0.0,
+                   ct->sent * conf->req_size, ct->received * conf->res_size);
+        }
+    }
+    printf("THROUGHPUT: secs:%.6f reqs/sec:%.1f req_bytes:%zd (%.3f Gbit/s) res_bytes:%zd (%.3f Gbit/s)\n",
+           secs, secs > 0 ? responses / secs : 0.0,
+           req_bytes, cli_gbps(req_bytes, secs), res_bytes, cli_gbps(res_bytes, secs));
+
+    if (conf->udp) {
+        size_t sent = 0, received = 0, lost = 0, late = 0, duplicates = 0, reordered = 0;
+        for (unsigned i=0; i < conf->nthreads; i++) {
+            sent += thrs[i].sent;
+            received += thrs[i].received;
+            lost += thrs[i].lost;
+            late += thrs[i].late;
+            duplicates += thrs[i].duplicates;
+            reordered += thrs[i].reordered;
+        }
+        printf("UDP: sent:%zd received:%zd lost:%zd (%.3f%%) late:%zd duplicates:%zd reordered:%zd\n",
+               sent, received, lost, sent ? 100.0*lost/sent : 0.0, late, duplicates, reordered);
+    }
+
+    if (conf->zerocopy) {
+        size_t sends = 0, copied = 0;
+        for (unsigned i=0; i < conf->nthreads; i++) {
+            sends += thrs[i].zc_sends;
+            copied += thrs[i].zc_copied;
+        }
+        // copied sends (e.g., over loopback) got no benefit from MSG_ZEROCOPY
+        printf("ZEROCOPY: sends:%zd copied:%zd (%.1f%%)\n", sends, copied, sends ? 100.0*copied/sends : 0.0);
+    }
+
+    // CPU time over all threads (including the interval reporter)
+    printf("CPU: %.3f secs over %.3f secs (%.1f%% of a core)\n", cpu, wall, 100.0*cpu/wall);
 }
 
 static int
 main_cli(const char *pname, int argc, char *argv[]) {
 
-	struct addrinfo *connect_ai;
 	struct cli_conf cli_conf;
-    unsigned connect_errs=10;
 	extern char *optarg;
-    int fd;
     char c;
 
     cli_conf.burst = 1;
     cli_conf.nmessages = 1024;
     cli_conf.req_size = 0;
     cli_conf.res_size = 0;
+    cli_conf.mode = CLI_MODE_SYSCALL;
+    cli_conf.sqpoll = false;
+    cli_conf.nconns = 0; // default: one per thread
+    cli_conf.nthreads = 1;
+    cli_conf.rate = 0;
+    cli_conf.arrival = CLI_ARRIVAL_FIXED;
+    cli_conf.interval_secs = 0;
+    cli_conf.wait = RR_WAIT_BLOCK;
+    cli_conf.srv_tstamps = false;
+    memset(&cli_conf.svc, 0, sizeof(cli_conf.svc));
+    cli_conf.svc_points = NULL;
+    bool svc_sleep = false;
+    cli_conf.v2 = false;
+    cli_conf.kts = RR_KTS_NONE;
+    cli_conf.zerocopy = false;
+    cli_conf.out_fmt = CLI_OUT_TEXT;
+    cli_conf.out = stdout;
+    cli_conf.out_header = false;
+    const char *out_file = NULL;
+    cli_conf.trace = NULL;
+    const char *trace_file = NULL;
+    cli_conf.nsweep = 0;
+    cli_conf.slo_pct = cli_conf.slo_usecs = 0;
+    cli_conf.slo_secs = CLI_SLO_DEFAULT_SECS;
+    cli_conf.points_barrier = NULL;
+    cli_conf.points_done = false;
+    struct trace trace;
+    enum tsc_clock clock = TSC_CLOCK_AUTO;
+    unsigned timeout_ms = 100;
+    bool burst_set = false, wait_set = false;
 
     if (argc < 2) {
-        printf("Usage: %s cli <server address> [-b burst] [-n nmessages] [-q req_size] [-s res_size]\n", pname);
-        printf("\tburst: packets in-flight (default: %u)\n", cli_conf.burst);
-        printf("\tnmessages: total number of messages to send (default: %u)\n", cli_conf.nmessages);
+        printf("Usage: %s cli <server address> [-b burst] [-n nmessages] [-q req_size] [-s res_size] [-m mode] [-c connections] [-T nthreads] [-r rate] [-a arrival] [-i secs] [-t msecs] [-w wait] [-C clock] [-x] [-K tstamps] [-D service] [-d how] [-V version] [-Z] [-o format] [-R file] [-S sweep]... [-L slo]\n", pname);
+        printf("\taddress: tcp://host:port, udp://host:port, unix:///path (unixpacket:// for SOCK_SEQPACKET), or shm://name\n");
+        printf("\tburst: packets in-flight per connection (default: %u)\n", cli_conf.burst);
+        printf("\tnmessages: number of messages to send per connection (default: %u)\n", cli_conf.nmessages);
         printf("\treq_size: request payload size (default: %u)\n", cli_conf.req_size);
         printf("\tres_size: response payload size (default: %u)\n", cli_conf.req_size);
+        printf("\tmode: syscall, uring, or uring-sqpoll (default: syscall)\n");
+        printf("\tconnections: number of connections, spread over the threads (default: nthreads)\n");
+        printf("\tnthreads: number of pinned client threads (default: %u)\n", cli_conf.nthreads);
+        printf("\trate: open-loop mode: aggregate request rate (reqs/sec) over all connections.\n");
+        printf("\t      burst becomes the per-connection in-flight limit (default: %u)\n", CLI_OPEN_DEFAULT_BURST);
+        printf("\tarrival: open-loop inter-arrival times: fixed or poisson (default: fixed)\n");
+        printf("\tsecs: report throughput and latency every secs seconds (default: only at the end)\n");
+        printf("\tmsecs: UDP: requests not answered within msecs are counted as lost (default: %u)\n", timeout_ms);
+        printf("\twait: block, poll, spin, or busy-poll (default: block, which polls with multiple connections)\n");
+        printf("\tclock: timestamp source: tsc, clock (clock_gettime), or auto (tsc if invariant) (default: auto)\n");
+        printf("\t-x: request server timestamps, and report server and network time separately\n");
+        printf("\ttstamps: kernel (SO_TIMESTAMPING) timestamps: sw or hw (falls back to sw), to report stack and network time separately\n");
+        printf("\tservice: server service time per request (server block mode):\n");
+        printf("\t         fixed:<usecs>, exp:<mean usecs>, bimodal:<usecs>:<usecs>:<p> (p: probability of the second),\n");
+        printf("\t         or cdf:<file> (lines of \"<usecs> <cumulative probability>\")\n");
+        printf("\thow: spend the service time with spin (TSC) or sleep (default: spin)\n");
+        printf("\tversion: protocol version: 1, or 2 (32-bit sizes, aligned header). Sizes > %u imply 2 (default: 1)\n", RR_V1_MAX_SIZE);
+        printf("\t-Z: send requests with MSG_ZEROCOPY (syscall mode over TCP)\n");
+        printf("\tformat: results as text, json (JSON lines), or csv, with :file to write them to file instead\n");
+        printf("\t        of stdout. One record per run, and per interval with -i (default: text)\n");
+        printf("\tfile: write a binary per-request trace to file (decode it with: %s trace)\n", pname);
+        printf("\tsweep: burst|req|res=<v1>,<v2>,...: run nmessages per connection for each combination of the values of\n");
+        printf("\t       all -S parameters, over the same connections, and report each one (server block or epoll mode.\n");
+        printf("\t       A block server thread serves one connection at a time: use epoll for more connections than threads)\n");
+        printf("\tslo: <pct>:<usecs>[:<secs>]: search for the highest open-loop rate (starting from rate, or %.0f) where\n", CLI_SLO_START_RATE);
+        printf("\t     the pct percentile of latency is <= usecs, running each rate for secs (default: %.1f)\n", CLI_SLO_DEFAULT_SECS);
+        printf("\t     instead of nmessages. Report each step, the highest rate, and the curve (server modes: as for sweep)\n");
         exit(1);
     }
 
 	if (url_parse(&cli_conf.srv_url, argv[1]) < 0)
 		die("cannot parse URL:%s\n", argv[1]);
+    cli_conf.url_str = argv[1];
 
-	while ( (c = getopt(argc-1, &argv[1], "n:b:q:s:")) != -1) {
+	while ( (c = getopt(argc-1, &argv[1], "n:b:q:s:m:c:T:r:a:i:t:w:C:xK:D:d:V:Zo:R:S:L:")) != -1) {
 		switch (c) {
 
 			case 'b':
 			if ((cli_conf.burst = atol(optarg)) < 1)
 				die("burst specified is < 1\n");
+			burst_set = true;
 			break;
 
 			case 'n':
@@ -358,22 +4789,381 @@ main_cli(const char *pname, int argc, char *argv[]) {
             cli_conf.res_size = atol(optarg);
             break;
 
+            case 'm':
+            if (strcmp(optarg, "syscall") == 0) {
+                cli_conf.mode = CLI_MODE_SYSCALL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                cli_conf.mode = CLI_MODE_URING;
+            } else if (strcmp(optarg, "uring-sqpoll") == 0) {
+                cli_conf.mode = CLI_MODE_URING;
+                cli_conf.sqpoll = true;
+            } else {
+                die("unknown client mode: %s\n", optarg);
+            }
+            break;
+
+            case 'c':
+            if ((cli_conf.nconns = atol(optarg)) < 1)
+                die("connections specified is < 1\n");
+            break;
+
+            case 'T':
+            if ((cli_conf.nthreads = atol(optarg)) < 1)
+                die("nthreads specified is < 1\n");
+            break;
+
+            case 'r':
+            if ((cli_conf.rate = atof(optarg)) <= 0)
+                die("rate specified is <= 0\n");
+            break;
+
+            case 'a':
+            if (strcmp(optarg, "fixed") == 0)
+                cli_conf.arrival = CLI_ARRIVAL_FIXED;
+            else if (strcmp(optarg, "poisson") == 0)
+                cli_conf.arrival = CLI_ARRIVAL_POISSON;
+            else
+                die("unknown arrival distribution: %s\n", optarg);
+            break;
+
+            case 'i':
+            if ((cli_conf.interval_secs = atof(optarg)) <= 0)
+                die("interval specified is <= 0\n");
+            break;
+
+            case 't':
+            if ((timeout_ms = atol(optarg)) < 1)
+                die("timeout specified is < 1\n");
+            break;
+
+            case 'w':
+            cli_conf.wait = rr_wait_parse(optarg);
+            wait_set = true;
+            break;
+
+            case 'C':
+            clock = rr_clock_parse(optarg);
+            break;
+
+            case 'x':
+            cli_conf.srv_tstamps = true;
+            break;
+
+            case 'K':
+            cli_conf.kts = rr_kts_parse(optarg);
+            break;
+
+            case 'D':
+            free(cli_conf.svc_points);
+            rr_svc_parse(optarg, &cli_conf.svc, &cli_conf.svc_points);
+            break;
+
+            case 'V':
+            if (strcmp(optarg, "1") == 0)
+                cli_conf.v2 = false;
+            else if (strcmp(optarg, "2") == 0)
+                cli_conf.v2 = true;
+            else
+                die("unknown protocol version: %s\n", optarg);
+            break;
+
+            case 'd':
+            if (strcmp(optarg, "spin") == 0)
+                svc_sleep = false;
+            else if (strcmp(optarg, "sleep") == 0)
+                svc_sleep = true;
+            else
+                die("unknown service time wait: %s\n", optarg);
+            break;
+
+            case 'Z':
+            cli_conf.zerocopy = true;
+            break;
+
+            case 'o':
+            cli_conf.out_fmt = cli_out_parse(optarg, &out_file);
+            break;
+
+            case 'R':
+            trace_file = optarg;
+            break;
+
+            case 'S':
+            cli_sweep_parse(&cli_conf, optarg);
+            break;
+
+            case 'L':
+            cli_slo_parse(&cli_conf, optarg);
+            break;
+
             default:
             die("Unexpected option: %c\n", c);
 		}
 	}
 
-	connect_ai = url_getaddrinfo(&cli_conf.srv_url, false);
-	for (unsigned i=0; ;) {
-	    fd = ai_connect(connect_ai, NULL);
-	    if (fd != -1)
-	        break;
-        perror("connect");
-	    if (++i == connect_errs)
-	        die("bailing out after %d connection attempts\n", connect_errs);
-	}
-	cli_run(&cli_conf, fd);
+    cli_conf.svc.sleep = svc_sleep;
+    // the version is the same for all the points of a sweep
+    if (cli_sweep_max(&cli_conf, CLI_SWEEP_REQ, cli_conf.req_size) > RR_V1_MAX_SIZE ||
+        cli_sweep_max(&cli_conf, CLI_SWEEP_RES, cli_conf.res_size) > RR_V1_MAX_SIZE)
+        cli_conf.v2 = true;
+    if (cli_conf.svc.dist)
+        rr_svc_print(cli_diag(&cli_conf), "", &cli_conf.svc, cli_conf.svc_points);
+
+    if (cli_conf.nconns == 0)
+        cli_conf.nconns = cli_conf.nthreads;
+    else if (cli_conf.nconns < cli_conf.nthreads)
+        die("connections (%u) < nthreads (%u)\n", cli_conf.nconns, cli_conf.nthreads);
+
+    if (cli_conf.mode == CLI_MODE_URING && cli_conf.nconns != cli_conf.nthreads)
+        die("uring mode supports a single connection per thread\n");
+    if (cli_conf.mode == CLI_MODE_URING && wait_set)
+        die("wait strategies are not supported in uring mode\n");
+    if (cli_conf.mode == CLI_MODE_URING && cli_conf.srv_tstamps)
+        die("server timestamps are not supported in uring mode\n");
+    if (cli_conf.mode == CLI_MODE_URING && cli_conf.kts)
+        die("kernel timestamps are not supported in uring mode\n");
+    if (cli_conf.mode == CLI_MODE_URING && cli_conf.zerocopy)
+        die("zero-copy is only supported in syscall mode\n");
+    if (cli_conf.zerocopy && cli_conf.kts)
+        die("zero-copy is not supported with kernel timestamps\n");
+    bool points = cli_conf.nsweep > 0 || cli_conf.slo_usecs > 0;
+    if (points && (cli_conf.kts || cli_conf.interval_secs > 0 || trace_file))
+        die("sweeps and SLO searches are not supported with kernel timestamps, interval reporting, or traces\n");
+    if (cli_conf.nsweep > 0 && cli_conf.slo_usecs > 0)
+        die("sweeps and SLO searches cannot be combined\n");
+    if (cli_conf.slo_usecs > 0 && cli_conf.rate == 0)
+        cli_conf.rate = CLI_SLO_START_RATE;
+
+    // before any conversions between ticks and time
+    clock = tsc_clock_init(clock);
+    fprintf(cli_diag(&cli_conf), "CLOCK: %s khz:%" PRIu64 " (%s)\n", tsc_clock_name(clock), getKhz(), tsc_khz_source);
+
+    if (cli_conf.rate > 0) {
+        if (cli_conf.mode != CLI_MODE_SYSCALL)
+            die("open-loop mode is only supported in syscall mode\n");
+        if (!burst_set)
+            cli_conf.burst = CLI_OPEN_DEFAULT_BURST;
+        cli_conf.interval_ticks = __tsc_secs2ticks((double)cli_conf.nconns / cli_conf.rate);
+        if (cli_conf.interval_ticks == 0)
+            die("rate too high\n");
+    }
+
+    cli_conf.connect_ai = url_getaddrinfo(&cli_conf.srv_url, false);
+    if (!cli_conf.connect_ai)
+        die("cannot resolve URL:%s\n", argv[1]);
+
+    cli_conf.udp = (cli_conf.connect_ai->ai_socktype == SOCK_DGRAM);
+    cli_conf.shm = (strcmp(cli_conf.srv_url.prot, "shm") == 0);
+    cli_conf.seqpacket = (cli_conf.connect_ai->ai_socktype == SOCK_SEQPACKET);
+    if (cli_conf.zerocopy && (cli_conf.connect_ai->ai_family == AF_UNIX || cli_conf.udp))
+        die("zero-copy is only supported over TCP\n");
+    // a HELO might not fit in the record the server reads
+    if (points && (cli_conf.udp || cli_conf.seqpacket))
+        die("sweeps and SLO searches are not supported over UDP and unixpacket\n");
+    if (cli_conf.connect_ai->ai_family == AF_UNIX) {
+        if (cli_conf.kts)
+            die("kernel timestamps are only supported over TCP\n");
+        if (cli_conf.mode != CLI_MODE_SYSCALL && (cli_conf.shm || cli_conf.seqpacket))
+            die("shm and unixpacket are only supported in syscall mode\n");
+    }
+    if (cli_conf.udp) {
+        if (cli_conf.mode != CLI_MODE_SYSCALL)
+            die("UDP is only supported in syscall mode\n");
+        if (cli_conf.srv_tstamps)
+            die("UDP: server timestamps are not supported\n");
+        if (cli_conf.kts)
+            die("UDP: kernel timestamps are not supported\n");
+        if (cli_conf.svc.dist)
+            die("UDP: service times are not supported\n");
+        if (cli_conf.v2)
+            die("UDP: protocol v2 is not supported\n");
+        if (sizeof(struct rr_hdr) + MAX(cli_conf.req_size, cli_conf.res_size) > RR_UDP_MAX_SIZE)
+            die("UDP: message size exceeds the maximum datagram size (%u)\n", RR_UDP_MAX_SIZE);
+        cli_conf.timeout_ticks = __tsc_secs2ticks(timeout_ms / 1000.0);
+    }
+
+    if (out_file && !(cli_conf.out = fopen(out_file, "w")))
+        die_perr("%s", out_file);
+    if (trace_file) {
+        int err = trace_create(&trace, trace_file, cli_conf.nconns, cli_conf.nmessages, getKhz());
+        if (err < 0)
+            die("%s: %s\n", trace_file, strerror(-err));
+        cli_conf.trace = &trace;
+    }
+
+    double t_start = cli_now_secs();
+    double cpu = rr_cpu_secs(RUSAGE_SELF);
+
+    struct cli_thread *thrs = xcalloc(cli_conf.nthreads, sizeof(*thrs));
+    for (unsigned i=0; i < cli_conf.nthreads; i++) {
+        thrs[i].id = i;
+        thrs[i].conf = &cli_conf;
+        thrs[i].nconns = cli_conf.nconns / cli_conf.nthreads + (i < cli_conf.nconns % cli_conf.nthreads);
+        thrs[i].conn0 = i ? thrs[i-1].conn0 + thrs[i-1].nconns : 0;
+        thrs[i].conn_totals = xcalloc(thrs[i].nconns, sizeof(*thrs[i].conn_totals));
+        cli_lat_init(&thrs[i].lat, cli_conf.interval_secs > 0 ? &thrs[i].ival : NULL, &cli_conf);
+    }
+
+    if (cli_conf.nsweep > 0) {
+        cli_sweep_run(&cli_conf, thrs);
+        goto out;
+    } else if (cli_conf.slo_usecs > 0) {
+        cli_slo_run(&cli_conf, thrs);
+        goto out;
+    }
+
+    if (cli_conf.nthreads == 1 && cli_conf.interval_secs == 0) {
+        cli_run(&thrs[0]);
+    } else {
+        for (unsigned i=0; i < cli_conf.nthreads; i++)
+            xpthread_create(&thrs[i].tid, NULL, cli_thread, &thrs[i]);
+        if (cli_conf.interval_secs > 0)
+            cli_report_intervals(&cli_conf, thrs);
+        for (unsigned i=0; i < cli_conf.nthreads; i++)
+            xpthread_join(thrs[i].tid, NULL);
+    }
+
+    double wall = cli_now_secs() - t_start;
+    cpu = rr_cpu_secs(RUSAGE_SELF) - cpu;
+
+    struct cli_lat *lat = &thrs[0].lat;
+    for (unsigned i=1; i < cli_conf.nthreads; i++)
+        cli_lat_merge(lat, &thrs[i].lat);
+    if (cli_conf.out_fmt == CLI_OUT_TEXT) {
+        cli_report_text(&cli_conf, thrs, lat, wall, cpu);
+    } else {
+        struct cli_record rec = { .type = "run", .secs = cli_threads_secs(&cli_conf, thrs), .h = lat->cum,
+                                  .lat = lat, .totals = true, .cpu_secs = cpu };
+        for (unsigned i=0; i < cli_conf.nthreads; i++) {
+            rec.req_bytes += thrs[i].sent * cli_conf.req_size;
+            rec.res_bytes += thrs[i].received * cli_conf.res_size;
+            rec.sent += thrs[i].sent;
+            rec.received += thrs[i].received;
+            rec.errors += thrs[i].errors;
+            rec.lost += thrs[i].lost;
+        }
+        cli_out_record(&cli_conf, &rec);
+    }
+
+out:
+    for (unsigned i=0; i < cli_conf.nthreads; i++) {
+        cli_lat_fini(&thrs[i].lat);
+        free(thrs[i].conn_totals);
+    }
+    free(thrs);
+    for (unsigned i=0; i < cli_conf.nsweep; i++)
+        free(cli_conf.sweep[i].vals);
+    free(cli_conf.svc_points);
+    freeaddrinfo(cli_conf.connect_ai);
+    if (cli_conf.out != stdout)
+        fclose(cli_conf.out);
+    if (cli_conf.trace)
+        trace_close(cli_conf.trace);
+    return 0;
+}
+
+/**
+ * Trace decoder
+ *
+ * Decodes a trace file written by the client (-R), either into CSV (one row
+ * per answered request), or into the histograms of the run, rebuilt offline.
+ */
+
+static void
+trace_csv(struct trace *t) {
+    const double srv_scale = t->hdr->srv_khz ? (double)t->hdr->khz / (double)t->hdr->srv_khz : 0;
+
+    printf("conn,rrid,send_tsc,recv_tsc,latency_usecs,req_size,res_size,srv_rx,srv_tx,srv_usecs\n");
+    for (uint64_t i=0; i < t->hdr->nrecs; i++) {
+        struct trace_rec *r = &t->recs[i];
+        if (!(r->flags & TRACE_REC_F_RECEIVED))
+            continue;
+        printf("%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%u,%u",
+               r->conn, r->rrid, r->send_tsc, r->recv_tsc, __tsc_getusecs(r->recv_tsc - r->send_tsc),
+               r->req_size, r->res_size);
+        if (r->flags & TRACE_REC_F_SRV_TSTAMPS)
+            printf(",%" PRIu64 ",%" PRIu64 ",%.3f\n", r->srv_rx, r->srv_tx,
+                   __tsc_getusecs((uint64_t)((r->srv_tx - r->srv_rx)*srv_scale)));
+        else
+            printf(",,,\n");
+    }
+}
+
+static void
+trace_hists(struct trace *t) {
+    const double srv_scale = t->hdr->srv_khz ? (double)t->hdr->khz / (double)t->hdr->srv_khz : 0;
+    struct hist *h = cli_hist_alloc(), *srv = cli_hist_alloc(), *net = cli_hist_alloc();
+    size_t missing = 0;
+
+    for (uint64_t i=0; i < t->hdr->nrecs; i++) {
+        struct trace_rec *r = &t->recs[i];
+        if (!(r->flags & TRACE_REC_F_RECEIVED)) {
+            missing++;
+            continue;
+        }
+        uint64_t ticks = r->recv_tsc - r->send_tsc;
+        hist_add(h, ticks);
+        if (r->flags & TRACE_REC_F_SRV_TSTAMPS) {
+            uint64_t srv_ticks = (uint64_t)((r->srv_tx - r->srv_rx)*srv_scale);
+            hist_add(srv, srv_ticks);
+            hist_add(net, ticks > srv_ticks ? ticks - srv_ticks : 0);
+        }
+    }
+
+    printf("TRACE: connections:%u messages:%u khz:%" PRIu64 " answered:%" PRIu64 " missing:%zd\n",
+           t->hdr->nconns, t->hdr->nmessages, t->hdr->khz, h->count, missing);
+    report_ticks(h);
+    if (srv->count > 0) {
+        report_percentiles("SERVER", srv);
+        report_percentiles("NETWORK", net);
+    }
+
+    free(h);
+    free(srv);
+    free(net);
+}
+
+static int
+main_trace(const char *pname, int argc, char *argv[]) {
+    extern char *optarg;
+    struct trace t;
+    bool csv = false;
+    char c;
+
+    if (argc < 2) {
+        printf("Usage: %s trace <trace file> [-o format]\n", pname);
+        printf("\tformat: hist (latency histograms) or csv (one row per answered request) (default: hist)\n");
+        exit(1);
+    }
+
+    while ( (c = getopt(argc-1, &argv[1], "o:")) != -1) {
+        switch (c) {
+            case 'o':
+            if (strcmp(optarg, "hist") == 0)
+                csv = false;
+            else if (strcmp(optarg, "csv") == 0)
+                csv = true;
+            else
+                die("unknown trace format: %s\n", optarg);
+            break;
+
+            default:
+            die("Unexpected option: %c\n", c);
+        }
+    }
+
+    int err = trace_open(&t, argv[1]);
+    if (err < 0)
+        die("%s: %s\n", argv[1], strerror(-err));
+    // convert ticks with the client's clock, not ours
+    tsc_khz = t.hdr->khz;
+
+    if (csv)
+        trace_csv(&t);
+    else
+        trace_hists(&t);
 
+    trace_close(&t);
     return 0;
 }
 
@@ -387,8 +5177,10 @@ main(int argc, char *argv[])
             return main_srv(pname, argc - 1, argv + 1);
         if (strcmp("cli", argv[1]) == 0)
             return main_cli(pname, argc - 1, argv + 1);
+        if (strcmp("trace", argv[1]) == 0)
+            return main_trace(pname, argc - 1, argv + 1);
     }
 
-    printf("Usage: %s (srv|cli) [srv or cli options]\n", pname);
+    printf("Usage: %s (srv|cli|trace) [srv, cli, or trace options]\n", pname);
     return 1;
 }
@@ -16,6 +16,9 @@ _Static_assert(sizeof(u32) == 4, "Invalid u32 size");
 _Static_assert(sizeof(u16) == 2, "Invalid u16 size");
 _Static_assert(sizeof(u8)  == 1, "Invalid u8 size");
 
+#define RR_MAGIC  0xfae1fae2
+#define RR_MAGIC2 0xfae3fae4 // v2 PING/PONGs
+
 enum rr_type {
     RR_TYPE_HELO  = 0,
     RR_TYPE_OHHI  = 1,
@@ -42,5 +45,93 @@ struct  rr_hdr {
     char      data[];
 } __attribute__((packed));
 
+// HELO options: the client requests them in the ->rrid field of the HELO, and
+// the server acknowledges the ones it supports in the ->rrid field of the
+// OHHI, together with RR_OPT_ACK.
+enum rr_opt {
+    // The OHHI is followed by a struct rr_opt_tstamps, and each PONG carries
+    // a struct rr_srv_tstamps between the header and its ->pong.dlen bytes of
+    // payload.
+    RR_OPT_SRV_TSTAMPS = 0x1,
+    // The HELO is followed by a struct rr_opt_svc (and its CDF points). The
+    // server spends a service time drawn from that distribution on each
+    // request before sending its response.
+    RR_OPT_SVC_TIME = 0x2,
+    // Protocol v2: the HELO is followed by a struct rr_opt_v2 with the
+    // message sizes (the ->helo sizes are ignored), and all PING/PONGs after
+    // the OHHI use struct rr_hdr2. HELO/OHHI always use struct rr_hdr.
+    RR_OPT_V2 = 0x4,
+    // The client might send another HELO, once all of its requests are
+    // answered, to renegotiate the connection (e.g., with other sizes). The
+    // server answers it with an OHHI, like the first one.
+    RR_OPT_SWEEP = 0x8,
+};
+
+// Set in the OHHI ->rrid by servers that acknowledge options. Servers that
+// predate options echo the HELO ->rrid, so, without it, the option bits of
+// an OHHI mean nothing. Clients never set it in the HELO.
+#define RR_OPT_ACK 0x80000000U
+
+struct rr_opt_tstamps {
+    u64 khz; // frequency of the server's ticks
+} __attribute__((packed));
+
+enum rr_svc_dist {
+    RR_SVC_NONE    = 0,
+    RR_SVC_FIXED   = 1, // ->ns[0]
+    RR_SVC_EXP     = 2, // exponential, with mean ->ns[0]
+    RR_SVC_BIMODAL = 3, // ->ns[1] with probability ->ppm/1e6, else ->ns[0]
+    RR_SVC_CDF     = 4, // empirical CDF of ->npoints struct rr_svc_point
+};
+
+#define RR_SVC_MAX_POINTS 1024
+
+struct rr_opt_svc {
+    u8  dist;
+    u8  sleep; // sleep instead of spinning for the service time
+    u16 npoints;
+    u32 ppm;
+    u64 ns[2];
+} __attribute__((packed));
+
+// a point of an empirical CDF: P(service time <= ->ns) = ->ppm/1e6. Points
+// are sorted, and the last one has ->ppm == 1e6.
+struct rr_svc_point {
+    u64 ns;
+    u32 ppm;
+} __attribute__((packed));
+
+struct rr_opt_v2 {
+    u32 req_size;
+    u32 res_size;
+} __attribute__((packed));
+
+// v2 header: naturally aligned, with 64-bit ids and timestamps, and 32-bit
+// sizes. Each message is padded to a multiple of 8 bytes, so that headers in
+// a stream stay aligned.
+struct rr_hdr2 {
+    u32 magic;    // RR_MAGIC2
+    u16 type;     // enum rr_type
+    u16 flags;    // enum rr_hdr2_flags
+    u32 dlen;     // payload bytes (excluding server timestamps and padding)
+    u32 reserved;
+    u64 rrid;
+    u64 tstamp;   // PING: client send time (client ticks), echoed in the PONG
+    char data[];
+};
+
+_Static_assert(sizeof(struct rr_hdr2) == 32, "Invalid rr_hdr2 size");
+
+enum rr_hdr2_flags {
+    // a struct rr_srv_tstamps precedes the payload
+    RR_HDR2_F_SRV_TSTAMPS = 0x1,
+};
+
+// server timestamps (in server ticks)
+struct rr_srv_tstamps {
+    u64 rx; // the request was received (receive completion)
+    u64 tx; // the response is about to be sent
+} __attribute__((packed));
+
 
 #endif /* RRBENCH_H__ */
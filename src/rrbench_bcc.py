@@ -1,239 +1,315 @@
 #!/usr/bin/env python3
-
-import ctypes
-from pprint import pprint
+#
+# Per-hop latency histograms of rrbench messages
+#
+# Every PING/PONG that passes through one of the hooks below (net_dev_queue,
+# net_dev_xmit, netif_receive_skb) is timestamped in the kernel. The last hop
+# of each request is kept in a BPF hash keyed by (client address, client port,
+# rrid), and the time since the previous hop of the same request is added to
+# a log2 histogram keyed by the two hops (hook, device, and message type).
+# Hence, a PING that goes through a veth pair and a bridge yields one
+# histogram per hop pair along the way, and the first hop of its PONG is
+# accounted against the last hop of the PING (i.e., the server side).
+#
+# Nothing is sent to user-space per message: the histograms are read (and
+# cleared) every interval.
+#
+# Only the first rrbench header of each packet is considered, so with batching
+# (-b) over TCP only the first request of each segment is traced.
+
+import argparse
+import sys
+import time
 
 from bcc import BPF
-from bcc.utils import printb
-
-
 
 prog = """
-
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
 #include <uapi/linux/udp.h>
 #include <uapi/linux/tcp.h>
+#include <uapi/linux/in.h>
 
 #define RR_MAGIC 0xfae1fae2
 
 enum rr_type {
-    RR_TYPE_HELO  = 0,
-    RR_TYPE_OHHI  = 1,
     RR_TYPE_PING  = 10,
     RR_TYPE_PONG  = 11,
 };
 
-struct  rr_hdr {
-    uint32_t magic;
-    uint32_t rrid;
-    uint8_t  type;
-    union {
-        struct {
-            uint16_t req_size;
-            uint16_t res_size;
-        } helo;
-        struct {
-            uint16_t dlen;
-        } ping;
-        struct {
-            uint16_t dlen;
-        } pong;
-    };
-    char      data[];
+// the prefix of struct rr_hdr we need
+struct rr_hdr_prefix {
+    u32 magic;
+    u32 rrid;
+    u8  type;
 } __attribute__((packed));
 
+enum rr_hop {
+    RR_HOP_QUEUE = 1, // net_dev_queue
+    RR_HOP_XMIT  = 2, // net_dev_xmit
+    RR_HOP_RECV  = 3, // netif_receive_skb
+};
 
-enum ev_type {
-    EV_TYPE_NETIF_RECEIVE_SKB  = 10,
+// a request, identified by its client endpoint and its rrid
+struct rr_key {
+    u32 cli_addr; // IPv4 address, or the last 32 bits of the IPv6 address
+    u16 cli_port;
+    u16 pad;
+    u32 rrid;
 };
 
-struct net_dev_event {
-    char dev[16];
+struct rr_hop_ev {
+    u64 ts;
+    char dev[IFNAMSIZ];
+    u8 hop;
+    u8 type;
 };
 
-struct event {
-    uint32_t rrid;
-    uint8_t ev_ty;
-    union {
-        struct net_dev_event net_dev;
-    } ev_data;
-} __attribute__((packed));
+struct hop_edge {
+    char from_dev[IFNAMSIZ];
+    char to_dev[IFNAMSIZ];
+    u8 from_hop, from_type;
+    u8 to_hop, to_type;
+};
 
-/*
-BPF_PERF_OUTPUT(events);
+struct hop_hkey {
+    struct hop_edge edge;
+    u64 slot;
+};
 
-struct netif_receive_skb_args  {
-    // from /sys/kernel/tracing/events/net/netif_receive_skb/format
-    u64 __unused__;
-    u64 skbaddr;
-    u32 len;
-    u64 name__;
+struct hop_stat {
+    u64 count;
+    u64 sum_ns;
 };
 
-int
-trace_netif_receive_skb(struct netif_receive_skb_args *args)
-{
-    //struct event ev = {0};
-    //struct net_device *netdev;
-    //bpf_probe_read(&netdev, sizeof(netdev), &skb->dev);
-    //bpf_probe_read_str(&ev.ev_data.net_dev.dev, sizeof(ev.ev_data.net_dev.dev), &netdev->name);
-    //ev.ev_ty = EV_TYPE_NETIF_RECEIVE_SKB;
-    //events.perf_submit(ctx, &ev, sizeof(ev));
-    char devname[16];
-    unsigned short name_off = args->name__ & 0xFFFF;
-    // unsigned short name_len = args->name__ >> 16;
-    bpf_probe_read_str(devname, 16, (char *)args + name_off);
-
-    struct sk_buff *skb = args->skbaddr;
-    bpf_probe_read(&iphdr_byte0, 1, ip);
-    if ((iphdr_byte0>>4) == 4) {
-        u8 v4_prot;
-        bpf_probe_read(&v4_prot, 1, &ip->protocol);
-        if (v4_prot == 0x06) { // TCP
-            struct tcphdr *tcp_ = skb_to_tcphdr(skb);
-            struct tcphdr tcp;
-            bpf_probe_read(&tcp, sizeof(tcp), tcp_);
-            u16 port = bpf_htons(4053);
-            bpf_trace_printk("port=%u tcp.source=%u tcp.dest=%u\\n", port, tcp.source, tcp.dest);
-            if (tcp.source != port && tcp.dest != port) {
-                return 0;
-            }
-            struct rr_hdr rr_hdr;
-            bpf_probe_read(&rr_hdr, sizeof(rr_hdr), (char *)tcp_ + (tcp.doff<<2));
-            bpf_trace_printk("len=%u name=%s magic=0x%lx\\n", args->len, devname, rr_hdr.magic);
-        }
+BPF_TABLE("lru_hash", struct rr_key, struct rr_hop_ev, last_hop, RR_MAX_INFLIGHT);
+BPF_HISTOGRAM(hop_hist, struct hop_hkey, 4096);
+BPF_HASH(hop_stats, struct hop_edge, struct hop_stat, 1024);
+
+// parse the packet starting at @nh (network header), and fill @key and @type
+// if it is an rrbench PING/PONG on RR_PORT
+static inline int
+rr_parse(unsigned char *nh, struct rr_key *key, u8 *type) {
+    u8 ipver, proto;
+    unsigned char *th;
+    u32 saddr, daddr;
+
+    bpf_probe_read_kernel(&ipver, 1, nh);
+    ipver >>= 4;
+    if (ipver == 4) {
+        struct iphdr ip;
+        bpf_probe_read_kernel(&ip, sizeof(ip), nh);
+        proto = ip.protocol;
+        saddr = ip.saddr;
+        daddr = ip.daddr;
+        th = nh + (ip.ihl << 2);
+    } else if (ipver == 6) {
+        // NB: extension headers are not supported
+        struct ipv6hdr ip6;
+        bpf_probe_read_kernel(&ip6, sizeof(ip6), nh);
+        proto = ip6.nexthdr;
+        saddr = ip6.saddr.in6_u.u6_addr32[3];
+        daddr = ip6.daddr.in6_u.u6_addr32[3];
+        th = nh + sizeof(ip6);
+    } else {
+        return -1;
     }
 
-    return 0;
-}
-*/
+    u16 sport, dport;
+    unsigned char *payload;
+    if (proto == IPPROTO_TCP) {
+        struct tcphdr tcp;
+        bpf_probe_read_kernel(&tcp, sizeof(tcp), th);
+        sport = tcp.source;
+        dport = tcp.dest;
+        payload = th + (tcp.doff << 2);
+    } else if (proto == IPPROTO_UDP) {
+        struct udphdr udp;
+        bpf_probe_read_kernel(&udp, sizeof(udp), th);
+        sport = udp.source;
+        dport = udp.dest;
+        payload = th + sizeof(udp);
+    } else {
+        return -1;
+    }
 
-static inline struct udphdr *skb_to_udphdr(const struct sk_buff *skb)
-{
-    // unstable API. verify logic in udp_hdr() -> skb_transport_header().
-    return (struct udphdr *)(skb->head + skb->transport_header);
-}
-static inline struct tcphdr *skb_to_tcphdr(const struct sk_buff *skb)
-{
-    // unstable API. verify logic in tcp_hdr() -> skb_transport_header().
-    return (struct tcphdr *)(skb->head + skb->transport_header);
-}
-static inline struct iphdr *skb_to_iphdr(const struct sk_buff *skb)
-{
-    // unstable API. verify logic in ip_hdr() -> skb_network_header().
-    return (struct iphdr *)(skb->head + skb->network_header);
-}
+    const u16 port = bpf_htons(RR_PORT);
+    if (dport == port) {
+        key->cli_addr = saddr;
+        key->cli_port = sport;
+    } else if (sport == port) {
+        key->cli_addr = daddr;
+        key->cli_port = dport;
+    } else {
+        return -1;
+    }
 
+    // NB: for TCP, this might read past the end of a packet without payload,
+    // but then the magic will not match.
+    struct rr_hdr_prefix rr = {0};
+    bpf_probe_read_kernel(&rr, sizeof(rr), payload);
+    if (rr.magic != RR_MAGIC || (rr.type != RR_TYPE_PING && rr.type != RR_TYPE_PONG))
+        return -1;
 
+    key->pad = 0;
+    key->rrid = rr.rrid;
+    *type = rr.type;
+    return 0;
+}
 
 static inline void
-rr_check(short prefix, struct sk_buff *skb, char *devname, bool verbose) {
-    u8 iphdr_byte0;
-    struct iphdr *ip = skb_to_iphdr(skb);
-    bpf_probe_read(&iphdr_byte0, 1, ip);
-    if ((iphdr_byte0>>4) == 4) {
-        u8 v4_prot;
-        bpf_probe_read(&v4_prot, 1, &ip->protocol);
-        if (v4_prot == 0x06) { // TCP
-            struct tcphdr *tcp_ = skb_to_tcphdr(skb);
-            struct tcphdr tcp;
-            bpf_probe_read(&tcp, sizeof(tcp), tcp_);
-            u16 port = bpf_htons(5554);
-            if (tcp.source != port && tcp.dest != port) {
-                return;
-            }
-            /*
-            if (verbose && tcp.dest == port) {
-                bpf_trace_printk("%u: RR: TCP cli->srv skb->len=%u skb->data_len=%u\\n", prefix, skb->len, skb->data_len);
-            }
-            */
-
-            struct rr_hdr rr_hdr = {0};
-            bpf_probe_read(&rr_hdr, sizeof(rr_hdr), (char *)tcp_ + (tcp.doff<<2));
-            if (rr_hdr.magic == 0xfae1fae2) {
-                if (rr_hdr.type ==  10) {
-                    bpf_trace_printk("%u: RR: PING name=%s rrid=%u\\n", prefix, devname, rr_hdr.rrid);
-                } else if (rr_hdr.type == 11) {
-                    bpf_trace_printk("%u: RR: PONG name=%s rrid=%u\\n", prefix, devname, rr_hdr.rrid);
-                }
-            }
+rr_hop(struct sk_buff *skb, bool rx, const char *dev, u8 hop) {
+    struct rr_key key = {};
+    struct rr_hop_ev ev = {};
+    unsigned char *nh;
+
+    // On TX, the network header offset is set. On RX, at netif_receive_skb,
+    // it might not be yet, but ->data points to the network header.
+    if (rx) {
+        nh = skb->data;
+    } else {
+        unsigned char *head = skb->head;
+        u16 off = skb->network_header;
+        nh = head + off;
+    }
+
+    if (rr_parse(nh, &key, &ev.type) != 0)
+        return;
+
+    ev.ts = bpf_ktime_get_ns();
+    ev.hop = hop;
+    __builtin_memcpy(ev.dev, dev, IFNAMSIZ);
+
+    struct rr_hop_ev *prev = last_hop.lookup(&key);
+    if (prev && ev.ts >= prev->ts) {
+        u64 delta = ev.ts - prev->ts;
+        struct hop_hkey hk = {};
+        __builtin_memcpy(hk.edge.from_dev, prev->dev, IFNAMSIZ);
+        __builtin_memcpy(hk.edge.to_dev, dev, IFNAMSIZ);
+        hk.edge.from_hop = prev->hop;
+        hk.edge.from_type = prev->type;
+        hk.edge.to_hop = hop;
+        hk.edge.to_type = ev.type;
+        hk.slot = bpf_log2l(delta);
+        hop_hist.increment(hk);
+
+        struct hop_stat zero = {}, *st;
+        st = hop_stats.lookup_or_try_init(&hk.edge, &zero);
+        if (st) {
+            __sync_fetch_and_add(&st->count, 1);
+            __sync_fetch_and_add(&st->sum_ns, delta);
         }
     }
 
+    last_hop.update(&key, &ev);
 }
 
-TRACEPOINT_PROBE(net, netif_receive_skb) {
-    char devname[16];
-    TP_DATA_LOC_READ_CONST(devname, name, 16);
-    struct sk_buff *skb = args->skbaddr;
-    rr_check(100, skb, devname, false);
-
+TRACEPOINT_PROBE(net, net_dev_queue) {
+    char dev[IFNAMSIZ];
+    TP_DATA_LOC_READ_CONST(dev, name, IFNAMSIZ);
+    rr_hop((struct sk_buff *)args->skbaddr, false, dev, RR_HOP_QUEUE);
     return 0;
 }
 
 TRACEPOINT_PROBE(net, net_dev_xmit) {
-    char devname[16];
-    TP_DATA_LOC_READ_CONST(devname, name, 16);
-    struct sk_buff *skb = args->skbaddr;
-    rr_check(2, skb, devname, false);
+    char dev[IFNAMSIZ];
+    TP_DATA_LOC_READ_CONST(dev, name, IFNAMSIZ);
+    rr_hop((struct sk_buff *)args->skbaddr, false, dev, RR_HOP_XMIT);
     return 0;
 }
 
-TRACEPOINT_PROBE(net, net_dev_queue) {
-    char devname[16];
-    TP_DATA_LOC_READ_CONST(devname, name, 16);
-    struct sk_buff *skb = args->skbaddr;
-    rr_check(1, skb, devname, true);
+// NB: use a tracepoint instead of a kprobe, because netif_receive_skb_list
+// is typically used.
+TRACEPOINT_PROBE(net, netif_receive_skb) {
+    char dev[IFNAMSIZ];
+    TP_DATA_LOC_READ_CONST(dev, name, IFNAMSIZ);
+    rr_hop((struct sk_buff *)args->skbaddr, true, dev, RR_HOP_RECV);
     return 0;
 }
-
 """
 
-class NetDevEv(ctypes.Structure):
-    _fields_ = [
-        ('dev', ctypes.c_char*16)
-    ]
+HOP_NAMES = {1: "queue", 2: "xmit", 3: "recv"}
+TYPE_NAMES = {10: "PING", 11: "PONG"}
+
+
+def hop_name(dev, hop, ty):
+    return "%s:%s@%s" % (TYPE_NAMES.get(ty, ty), HOP_NAMES.get(hop, hop), dev.decode(errors="replace"))
+
+
+def edge_name(e):
+    return "%s -> %s" % (hop_name(e.from_dev, e.from_hop, e.from_type),
+                         hop_name(e.to_dev, e.to_hop, e.to_type))
+
+
+def edge_id(e):
+    return (bytes(e.from_dev), e.from_hop, e.from_type, bytes(e.to_dev), e.to_hop, e.to_type)
+
 
+def print_log2(slots, width=40):
+    """ print a log2 histogram ({slot: count}) of nsec values """
+    if not slots:
+        return
+    vmax = max(slots.values())
+    for s in range(min(slots), max(slots) + 1):
+        low = (1 << s) >> 1
+        high = (1 << s) - 1
+        cnt = slots.get(s, 0)
+        stars = int(width * cnt / vmax)
+        print("    %10d -> %-10d : %-10d |%-*s|" % (low, high, cnt, width, "*" * stars))
 
-class Ev(ctypes.Union):
-    _pack_ = 1
-    _fields_ = [
-        ('net_dev', NetDevEv),
-    ]
 
-class Event(ctypes.Structure):
-    _pack_ = 1
-    _fields_ = [
-            ('rrid', ctypes.c_uint32),
-            ('ev_ty', ctypes.c_ubyte),
-            ('ev_data', Ev),
-    ]
+def report(b, order):
+    stats = b["hop_stats"]
+    hist = b["hop_hist"]
 
+    hists = {}
+    for k, v in hist.items():
+        hists.setdefault(edge_id(k.edge), {})[k.slot] = v.value
+    edges = []
+    for k, v in stats.items():
+        edges.append((k, v.count, v.sum_ns))
+    hist.clear()
+    stats.clear()
 
-def handle_kprobe_event(cpu, data, size):
-    event = ctypes.cast(data, ctypes.POINTER(Event)).contents
-    print(event.ev_ty, event.ev_data.net_dev.dev)
+    # print edges in the order they were first seen, which roughly follows the
+    # path of the messages
+    for e, _, _ in edges:
+        eid = edge_id(e)
+        if eid not in order:
+            order[eid] = len(order)
+    edges.sort(key=lambda x: order[edge_id(x[0])])
 
+    print("%s" % time.strftime("%H:%M:%S"))
+    for e, count, sum_ns in edges:
+        print("  %s: count:%d avg:%.3f usecs" % (edge_name(e), count, sum_ns / count / 1000.0 if count else 0))
+        print_log2(hists.get(edge_id(e), {}))
+    sys.stdout.flush()
 
-import os
 
 if __name__ == '__main__':
-    path = os.path.dirname(os.path.abspath( __file__ ))
-    b = BPF(text=prog, hdr_file="%s/rrbench.h")
-    # NB: use a tracepoint instead of a kprobe, because netif_receive_skb_list
-    # is typically used.
-    #b.attach_tracepoint(tp="net:netif_receive_skb", fn_name="trace_netif_receive_skb")
-    #b["events"].open_perf_buffer(handle_kprobe_event)
-    #while 1:
-    #    b.perf_buffer_poll()
-    # format output
-    while 1:
+    parser = argparse.ArgumentParser(description="per-hop latency histograms of rrbench messages")
+    parser.add_argument("-p", "--port", type=int, default=5554, help="rrbench server port (default: 5554)")
+    parser.add_argument("-i", "--interval", type=float, default=1.0, help="report interval in seconds (default: 1)")
+    parser.add_argument("-c", "--count", type=int, default=0, help="number of reports (default: until interrupted)")
+    parser.add_argument("-m", "--max-inflight", type=int, default=65536,
+                        help="number of requests to track at the same time (default: 65536)")
+    args = parser.parse_args()
+
+    cflags = ["-DRR_PORT=%d" % args.port, "-DRR_MAX_INFLIGHT=%d" % args.max_inflight]
+    b = BPF(text=prog, cflags=cflags)
+    print("Tracing rrbench messages on port %d. Ctrl-C to stop." % args.port)
+
+    order = {}
+    n = 0
+    while True:
         try:
-            (task, pid, cpu, flags, ts, msg) = b.trace_fields()
-        except ValueError:
-            continue
+            time.sleep(args.interval)
         except KeyboardInterrupt:
-            exit()
-        printb(b"%-18.9f %-16s %-6d %s" % (ts, task, pid, msg))
+            report(b, order)
+            break
+        report(b, order)
+        n += 1
+        if args.count and n >= args.count:
+            break
@@ -0,0 +1,344 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/futex.h>
+
+#include "shm.h"
+
+#define SHM_MAGIC 0x72727368 // "rrsh"
+#define SHM_CACHELINE 64
+// how long a waiter sleeps before checking if the peer is gone
+#define SHM_WAIT_NSECS (100*1000*1000)
+// how many times a waiter spins before checking if the peer is gone
+#define SHM_SPIN_CHECK (1U << 20)
+
+struct shm_ring {
+    // producer: bytes produced, and whether it closed its side
+    _Alignas(SHM_CACHELINE) uint32_t head;
+    uint32_t closed;
+    // consumer: bytes consumed
+    _Alignas(SHM_CACHELINE) uint32_t tail;
+    // set by a consumer sleeping on ->head, and a producer sleeping on ->tail
+    _Alignas(SHM_CACHELINE) uint32_t cons_waiting;
+    uint32_t prod_waiting;
+    _Alignas(SHM_CACHELINE) char data[];
+};
+
+// start of the segment: the client->server ring follows at ->ring_off[0], and
+// the server->client ring at ->ring_off[1]
+struct shm_seg {
+    uint32_t magic;
+    uint32_t ring_size;
+    uint64_t ring_off[2];
+};
+
+static inline size_t
+shm_ring_bytes(size_t ring_size) {
+    return sizeof(struct shm_ring) + ring_size;
+}
+
+static inline int
+sys_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *ts) {
+    return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+
+static inline void
+shm_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// is the peer gone (the control socket was closed)?
+static bool
+shm_peer_gone(struct shm_chan *ch) {
+    struct pollfd pfd = { .fd = ch->ctl, .events = POLLRDHUP };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLRDHUP|POLLHUP|POLLERR));
+}
+
+// wait until *@word != @val. @waiting announces a sleeping waiter.
+// returns -1 if the peer is gone
+static int
+shm_wait(struct shm_chan *ch, uint32_t *word, uint32_t val, uint32_t *waiting, unsigned *spins) {
+    if (ch->spin) {
+        shm_cpu_relax();
+        if (++*spins % SHM_SPIN_CHECK == 0 && shm_peer_gone(ch))
+            return -1;
+        return 0;
+    }
+
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = SHM_WAIT_NSECS };
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    // pairs with the fence in shm_wake(): either we see the new value, or the
+    // waker sees ->waiting set
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int ret = 0;
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) == val) {
+        ret = sys_futex(word, FUTEX_WAIT, val, &ts);
+        if (ret == -1 && errno == ETIMEDOUT && shm_peer_gone(ch))
+            ret = -1;
+        else
+            ret = 0;
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return ret;
+}
+
+static inline void
+shm_wake(uint32_t *word, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        sys_futex(word, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static void
+shm_chan_map_rings(struct shm_chan *ch, const struct shm_seg *seg, bool client) {
+    struct shm_ring *r0 = (struct shm_ring *)((char *)ch->map + seg->ring_off[0]);
+    struct shm_ring *r1 = (struct shm_ring *)((char *)ch->map + seg->ring_off[1]);
+    ch->tx = client ? r0 : r1;
+    ch->rx = client ? r1 : r0;
+}
+
+int
+shm_chan_connect(struct shm_chan *ch, int ctl, size_t ring_size, bool spin) {
+    int fd, err;
+
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) || ring_size > (1UL << 30))
+        return -EINVAL;
+
+    *ch = (struct shm_chan){0};
+    ch->ctl = ctl;
+    ch->spin = spin;
+
+    size_t off0 = SHM_CACHELINE;
+    size_t off1 = off0 + shm_ring_bytes(ring_size);
+    ch->map_size = off1 + shm_ring_bytes(ring_size);
+
+    fd = memfd_create("rrbench-shm", MFD_CLOEXEC);
+    if (fd == -1)
+        return -errno;
+    if (ftruncate(fd, ch->map_size) == -1)
+        goto fail;
+    ch->map = mmap(NULL, ch->map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+    if (ch->map == MAP_FAILED) {
+        ch->map = NULL;
+        goto fail;
+    }
+
+    // the segment is zeroed, so both rings are empty
+    struct shm_seg *seg = ch->map;
+    ch->ring_size = ring_size;
+    seg->magic = SHM_MAGIC;
+    seg->ring_size = ring_size;
+    seg->ring_off[0] = off0;
+    seg->ring_off[1] = off1;
+    shm_chan_map_rings(ch, seg, true);
+
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    if (sendmsg(ctl, &msg, 0) != 1)
+        goto fail;
+
+    close(fd);
+    return 0;
+
+fail:
+    err = -errno;
+    if (ch->map)
+        munmap(ch->map, ch->map_size);
+    close(fd);
+    *ch = (struct shm_chan){0};
+    return err;
+}
+
+int
+shm_chan_accept(struct shm_chan *ch, int ctl, bool spin) {
+    int fd = -1, err;
+
+    *ch = (struct shm_chan){0};
+    ch->ctl = ctl;
+    ch->spin = spin;
+
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t ret = recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC);
+    if (ret == -1)
+        return -errno;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (ret != 1 || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -EPROTO;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size == -1)
+        goto fail;
+    if ((size_t)size < sizeof(struct shm_seg)) {
+        errno = EPROTO;
+        goto fail;
+    }
+    ch->map_size = size;
+    ch->map = mmap(NULL, ch->map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+    if (ch->map == MAP_FAILED) {
+        ch->map = NULL;
+        goto fail;
+    }
+
+    // read the header once: the client can change it under us
+    struct shm_seg seg = *(volatile struct shm_seg *)ch->map;
+    uint64_t ring_bytes = shm_ring_bytes(seg.ring_size);
+    if (seg.magic != SHM_MAGIC || seg.ring_size == 0 || (seg.ring_size & (seg.ring_size - 1)) ||
+        ring_bytes > ch->map_size) {
+        errno = EPROTO;
+        goto fail;
+    }
+    for (unsigned i=0; i < 2; i++) {
+        if (seg.ring_off[i] % SHM_CACHELINE || seg.ring_off[i] < sizeof(seg) ||
+            seg.ring_off[i] > ch->map_size - ring_bytes) {
+            errno = EPROTO;
+            goto fail;
+        }
+    }
+    ch->ring_size = seg.ring_size;
+    shm_chan_map_rings(ch, &seg, false);
+
+    close(fd);
+    return 0;
+
+fail:
+    err = -errno;
+    if (ch->map)
+        munmap(ch->map, ch->map_size);
+    close(fd);
+    *ch = (struct shm_chan){0};
+    return err;
+}
+
+void
+shm_chan_close(struct shm_chan *ch) {
+    if (!ch->map)
+        return;
+
+    __atomic_store_n(&ch->tx->closed, 1, __ATOMIC_RELEASE);
+    // wake up a consumer sleeping on ->head (it will see ->closed)
+    sys_futex(&ch->tx->head, FUTEX_WAKE, INT_MAX, NULL);
+    munmap(ch->map, ch->map_size);
+    ch->map = NULL;
+    ch->tx = ch->rx = NULL;
+}
+
+ssize_t
+shm_chan_send(struct shm_chan *ch, const void *buf, size_t len, bool block) {
+    struct shm_ring *r = ch->tx;
+    const uint32_t size = ch->ring_size;
+    uint32_t head = r->head, tail, space;
+    unsigned spins = 0;
+
+    for (;;) {
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - tail > size) {
+            errno = EPROTO;
+            return -1;
+        }
+        space = size - (head - tail);
+        if (space > 0 || len == 0)
+            break;
+        if (!block) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (shm_wait(ch, &r->tail, tail, &r->prod_waiting, &spins) == -1) {
+            errno = EPIPE;
+            return -1;
+        }
+    }
+
+    size_t n = len < space ? len : space;
+    uint32_t off = head & (size - 1);
+    size_t n1 = size - off < n ? size - off : n;
+    memcpy(r->data + off, buf, n1);
+    memcpy(r->data, (const char *)buf + n1, n - n1);
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    shm_wake(&r->head, &r->cons_waiting);
+    return n;
+}
+
+ssize_t
+shm_chan_recv(struct shm_chan *ch, void *buf, size_t len, bool block) {
+    struct shm_ring *r = ch->rx;
+    const uint32_t size = ch->ring_size;
+    uint32_t tail = r->tail, head, avail;
+    unsigned spins = 0;
+
+    for (;;) {
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        avail = head - tail;
+        if (avail > size) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (avail > 0 || len == 0)
+            break;
+        if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) {
+            // the producer might have written before closing
+            if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != head)
+                continue;
+            return 0;
+        }
+        if (!block) {
+            errno = EAGAIN;
+            return -1;
+        }
+        // a peer that is gone is the same as one that closed the channel
+        if (shm_wait(ch, &r->head, head, &r->cons_waiting, &spins) == -1)
+            return 0;
+    }
+
+    size_t n = len < avail ? len : avail;
+    uint32_t off = tail & (size - 1);
+    size_t n1 = size - off < n ? size - off : n;
+    memcpy(buf, r->data + off, n1);
+    memcpy((char *)buf + n1, r->data, n - n1);
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    shm_wake(&r->tail, &r->prod_waiting);
+    return n;
+}
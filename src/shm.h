@@ -0,0 +1,70 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+#ifndef SHM_H__
+#define SHM_H__
+
+// Shared memory channels
+//
+// A channel is a pair of lock-free single-producer/single-consumer byte rings
+// (one per direction) in a memfd segment. The client creates the segment and
+// passes it to the server (SCM_RIGHTS) over a unix socket, the control socket,
+// which is otherwise only used to detect that the peer is gone.
+//
+// The rings have stream semantics (like a TCP socket): send and recv copy as
+// many bytes as there is space or data for. A waiting side either spins, or
+// sleeps on a futex on the ring position it waits for. The other side only
+// issues a FUTEX_WAKE if the waiter announced itself, so the fast path has no
+// system calls.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SHM_RING_SIZE_DEFAULT (1UL << 20)
+
+struct shm_ring;
+
+struct shm_chan {
+    int ctl; // control socket
+    bool spin; // spin instead of sleeping when waiting
+    struct shm_ring *tx, *rx;
+    // the peer can write anything to the segment, so the ring size is kept
+    // here, and ring positions are checked against it
+    uint32_t ring_size;
+    void *map;
+    size_t map_size;
+};
+
+// client: create a segment with two rings of @ring_size bytes (power of 2),
+// and pass it to the server over @ctl. returns 0 or -errno
+int shm_chan_connect(struct shm_chan *ch, int ctl, size_t ring_size, bool spin);
+
+// server: receive and map the segment from the client over @ctl.
+// returns 0 or -errno
+int shm_chan_accept(struct shm_chan *ch, int ctl, bool spin);
+
+// mark our side as closed, wake up the peer, and unmap the segment. Does not
+// close the control socket.
+void shm_chan_close(struct shm_chan *ch);
+
+// Send/receive up to @len bytes. If @block is set, wait until at least one
+// byte can be sent/received. Return the number of bytes, or -1 with errno set
+// to EAGAIN (not blocking), EPIPE (shm_chan_send(): peer gone), or EPROTO (the
+// peer corrupted the ring positions).
+// shm_chan_recv() returns 0 if the peer closed the channel (or is gone) and
+// there is no more data.
+ssize_t shm_chan_send(struct shm_chan *ch, const void *buf, size_t len, bool block);
+ssize_t shm_chan_recv(struct shm_chan *ch, void *buf, size_t len, bool block);
+
+#if defined(__cplusplus)
+} // end  extern "C"
+#endif
+
+#endif /* SHM_H__ */
@@ -0,0 +1,116 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int
+trace_create(struct trace *t, const char *path, uint32_t nconns, uint32_t nmessages, uint64_t khz) {
+    int err;
+
+    *t = (struct trace){0};
+    t->map_size = sizeof(struct trace_hdr) + (size_t)nconns*nmessages*sizeof(struct trace_rec);
+    t->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (t->fd == -1)
+        return -errno;
+
+    // allocate the blocks, so that writes to the mapping do not have to
+    if ((err = posix_fallocate(t->fd, 0, t->map_size)) != 0) {
+        // e.g., ENOSPC: a sparse file would SIGBUS on the first write that
+        // cannot be allocated
+        if (err != EOPNOTSUPP && err != EINVAL) {
+            errno = err;
+            goto fail;
+        }
+        // the file system cannot preallocate: the blocks are allocated on
+        // the first writes
+        if (ftruncate(t->fd, t->map_size) == -1)
+            goto fail;
+    }
+
+    t->map = mmap(NULL, t->map_size, PROT_READ|PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (t->map == MAP_FAILED) {
+        t->map = NULL;
+        goto fail;
+    }
+
+    t->hdr = t->map;
+    t->recs = (struct trace_rec *)(t->hdr + 1);
+    // the file is zeroed already, but write every page now, so that
+    // recording does not fault
+    memset(t->map, 0, t->map_size);
+    t->hdr->magic = TRACE_MAGIC;
+    t->hdr->version = TRACE_VERSION;
+    t->hdr->rec_size = sizeof(struct trace_rec);
+    t->hdr->khz = khz;
+    t->hdr->nrecs = (uint64_t)nconns*nmessages;
+    t->hdr->nconns = nconns;
+    t->hdr->nmessages = nmessages;
+    return 0;
+
+fail:
+    err = -errno;
+    close(t->fd);
+    *t = (struct trace){0};
+    return err;
+}
+
+int
+trace_open(struct trace *t, const char *path) {
+    struct stat st;
+    int err;
+
+    *t = (struct trace){0};
+    t->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (t->fd == -1)
+        return -errno;
+    if (fstat(t->fd, &st) == -1)
+        goto fail;
+    if ((size_t)st.st_size < sizeof(struct trace_hdr)) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    t->map_size = st.st_size;
+    t->map = mmap(NULL, t->map_size, PROT_READ, MAP_SHARED, t->fd, 0);
+    if (t->map == MAP_FAILED) {
+        t->map = NULL;
+        goto fail;
+    }
+
+    t->hdr = t->map;
+    t->recs = (struct trace_rec *)(t->hdr + 1);
+    if (t->hdr->magic != TRACE_MAGIC || t->hdr->version != TRACE_VERSION ||
+        t->hdr->rec_size != sizeof(struct trace_rec) ||
+        t->hdr->nrecs != (uint64_t)t->hdr->nconns*t->hdr->nmessages ||
+        sizeof(struct trace_hdr) + t->hdr->nrecs*sizeof(struct trace_rec) > t->map_size) {
+        errno = EPROTO;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = -errno;
+    if (t->map)
+        munmap(t->map, t->map_size);
+    close(t->fd);
+    *t = (struct trace){0};
+    return err;
+}
+
+void
+trace_close(struct trace *t) {
+    if (!t->map)
+        return;
+    munmap(t->map, t->map_size);
+    close(t->fd);
+    *t = (struct trace){0};
+}
@@ -0,0 +1,84 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+#ifndef TRACE_H__
+#define TRACE_H__
+
+// Per-request trace files
+//
+// A trace file is a header followed by a fixed number of records, one per
+// request: record i*nmessages + rrid is request rrid of connection i. The
+// file is allocated up front and mapped (shared), so recording a request is a
+// few stores into the page cache: there are no system calls, and, since the
+// blocks are allocated and the pages are prefaulted, no I/O in the hot path.
+//
+// Records of requests without a response (not sent, or lost for UDP) are
+// left zeroed, i.e., without TRACE_REC_F_RECEIVED.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define TRACE_MAGIC   0x72727472 // "rrtr"
+#define TRACE_VERSION 1
+
+struct trace_hdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;   // sizeof(struct trace_rec)
+    uint64_t khz;        // client ticks per msec
+    uint64_t srv_khz;    // server ticks per msec (0: no server timestamps)
+    uint64_t nrecs;      // nconns*nmessages
+    uint32_t nconns;
+    uint32_t nmessages;
+};
+
+enum {
+    TRACE_REC_F_RECEIVED    = 0x1, // the response arrived
+    TRACE_REC_F_SRV_TSTAMPS = 0x2, // ->srv_rx, ->srv_tx are set
+};
+
+struct trace_rec {
+    uint64_t rrid;
+    uint32_t conn;
+    uint32_t flags;
+    uint64_t send_tsc; // client ticks (intended send time in open-loop mode)
+    uint64_t recv_tsc; // client ticks
+    uint32_t req_size, res_size;
+    uint64_t srv_rx, srv_tx; // server ticks
+};
+
+struct trace {
+    int fd;
+    void *map;
+    size_t map_size;
+    struct trace_hdr *hdr;
+    struct trace_rec *recs;
+};
+
+// create @path with room for @nconns*@nmessages records, and map it.
+// returns 0 or -errno
+int trace_create(struct trace *t, const char *path, uint32_t nconns, uint32_t nmessages, uint64_t khz);
+
+// map an existing trace file read-only. returns 0 or -errno (-EPROTO if it is
+// not a trace file)
+int trace_open(struct trace *t, const char *path);
+
+void trace_close(struct trace *t);
+
+// records of connection @conn
+static inline struct trace_rec *
+trace_conn_recs(struct trace *t, uint32_t conn) {
+    return t->recs + (size_t)conn*t->hdr->nmessages;
+}
+
+#if defined(__cplusplus)
+} // end  extern "C"
+#endif
+
+#endif /* TRACE_H__ */
@@ -3,7 +3,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include <inttypes.h>
 
@@ -20,8 +23,25 @@ struct tsc {
 };
 typedef struct tsc tsc_t;
 
+// Clock sources behind get_ticks():
+//  TSC_CLOCK_CPU:       the CPU's cycle counter (rdtsc on x86)
+//  TSC_CLOCK_MONOTONIC: clock_gettime(CLOCK_MONOTONIC) (vDSO) in nsecs, for
+//                       when the cycle counter is not usable
+//
+// The source is selected once, with tsc_clock_init(), before taking any
+// timestamps. Ticks of different sources are not comparable.
+enum tsc_clock {
+	TSC_CLOCK_AUTO = 0, // CPU, if the TSC is invariant, otherwise MONOTONIC
+	TSC_CLOCK_CPU,
+	TSC_CLOCK_MONOTONIC,
+};
+
+static enum tsc_clock tsc_clock_source = TSC_CLOCK_CPU;
+
 #if defined(__i386__) || defined(__x86_64__)
-static inline uint64_t get_ticks(void)
+#include <cpuid.h>
+
+static inline uint64_t get_cpu_ticks(void)
 {
 	uint32_t hi,low;
 	uint64_t ret;
@@ -34,9 +54,19 @@ static inline uint64_t get_ticks(void)
 
 	return ret;
 }
+// does the TSC tick at a constant rate, regardless of P-/C-states?
+static inline bool tsc_invariant(void)
+{
+	unsigned eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		return false;
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+	return (edx >> 8) & 1;
+}
 #elif defined(__ia64__)
 #include <asm/intrinsics.h>
-static inline uint64_t get_ticks(void)
+static inline uint64_t get_cpu_ticks(void)
 {
 	uint64_t ret = ia64_getreg(_IA64_REG_AR_ITC);
 	ia64_barrier();
@@ -45,7 +75,7 @@ static inline uint64_t get_ticks(void)
 }
 #elif defined(__sparc__)
 // linux-2.6.28/arch/sparc64/kernel/time.c
-static inline uint64_t get_ticks(void)
+static inline uint64_t get_cpu_ticks(void)
 {
 	uint64_t t;
 	__asm__ __volatile__ (
@@ -59,6 +89,28 @@ static inline uint64_t get_ticks(void)
 #error "dont know how to count ticks"
 #endif
 
+#if !defined(__i386__) && !defined(__x86_64__)
+// no way to check: assume it is
+static inline bool tsc_invariant(void)
+{
+	return true;
+}
+#endif
+
+static inline uint64_t get_clock_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t get_ticks(void)
+{
+	if (__builtin_expect(tsc_clock_source == TSC_CLOCK_MONOTONIC, 0))
+		return get_clock_ticks();
+	return get_cpu_ticks();
+}
+
 static inline void tsc_init(tsc_t *tsc)
 {
 	tsc->ticks = 0;
@@ -107,49 +159,135 @@ static inline void tsc_pause(tsc_t *tsc)
 	#endif
 }
 
-static uint64_t __getKhz(void)
+// where the frequency returned by getKhz() came from
+static const char *tsc_khz_source = NULL;
+
+// the kernel's tsc_khz, if exported (not all kernels do)
+static uint64_t __tsc_sysfs_khz(void)
 {
 	uint64_t khz = 0;
 	FILE *freq;
-	char buff[512], *endptr;
-	int ret;
+	char buff[64], *endptr;
+	size_t ret;
 
-	freq = fopen("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", "r");
-	if (!freq) {
-		perror("fopen(/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq)");
+	freq = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+	if (!freq)
 		return 0;
-		//exit(1);
-	}
 
 	ret = fread(buff, 1, sizeof(buff) - 1, freq);
-	if (!ret){
-		perror("fread");
-		exit(1);
-	}
+	fclose(freq);
 	buff[ret] = '\0';
 
-	khz = strtoll(buff, &endptr, 10);
-	if (endptr == buff){
-		perror("strtod");
-		exit(1);
-	}
+	khz = strtoull(buff, &endptr, 10);
+	if (endptr == buff)
+		return 0;
 
 	return khz;
 }
 
+static inline uint64_t __tsc_raw_nsecs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+#define TSC_CALIBRATE_ROUNDS 5
+#define TSC_CALIBRATE_NSECS  (10*1000*1000)
+
+// Calibrate the cycle counter against CLOCK_MONOTONIC_RAW (which is not
+// subject to NTP adjustments). We spin for a few short rounds and take the
+// median, so that a round that was preempted between reading the two clocks
+// does not skew the result.
+static uint64_t __tsc_calibrate_khz(void)
+{
+	double khz[TSC_CALIBRATE_ROUNDS];
+
+	for (unsigned i=0; i < TSC_CALIBRATE_ROUNDS; i++) {
+		uint64_t ns0, ns1, t0, t1;
+		ns0 = __tsc_raw_nsecs();
+		t0 = get_cpu_ticks();
+		do {
+			ns1 = __tsc_raw_nsecs();
+			t1 = get_cpu_ticks();
+		} while (ns1 - ns0 < TSC_CALIBRATE_NSECS);
+		khz[i] = (double)(t1 - t0)*1e6/(double)(ns1 - ns0);
+	}
+
+	// insertion sort, for the median
+	for (unsigned i=1; i < TSC_CALIBRATE_ROUNDS; i++) {
+		double x = khz[i];
+		unsigned j = i;
+		for (; j > 0 && khz[j-1] > x; j--)
+			khz[j] = khz[j-1];
+		khz[j] = x;
+	}
+
+	return (uint64_t)(khz[TSC_CALIBRATE_ROUNDS/2] + 0.5);
+}
+
+static uint64_t __getKhz(void)
+{
+	uint64_t khz;
+
+	if (tsc_clock_source == TSC_CLOCK_MONOTONIC) {
+		tsc_khz_source = "clock_gettime";
+		return 1000000; // 1 tick = 1 nsec
+	}
+
+	if ((khz = __tsc_sysfs_khz()) != 0) {
+		tsc_khz_source = "tsc_freq_khz";
+		return khz;
+	}
+
+	tsc_khz_source = "calibrated";
+	return __tsc_calibrate_khz();
+}
+
+static uint64_t tsc_khz = 0;
+
 static inline uint64_t getKhz(void)
 {
-	static uint64_t khz = 0.0;
-	if (khz == 0.0){
-		khz = __getKhz();
+	if (tsc_khz == 0){
+		tsc_khz = __getKhz();
 	}
-	return khz;
+	return tsc_khz;
+}
+
+// select the clock source behind get_ticks(), and determine its frequency.
+// Returns the selected source.
+static inline enum tsc_clock tsc_clock_init(enum tsc_clock clock)
+{
+	if (clock == TSC_CLOCK_AUTO) {
+		clock = TSC_CLOCK_CPU;
+		if (!tsc_invariant()) {
+			fprintf(stderr, "TSC is not invariant: using clock_gettime()\n");
+			clock = TSC_CLOCK_MONOTONIC;
+		}
+	} else if (clock == TSC_CLOCK_CPU && !tsc_invariant()) {
+		fprintf(stderr, "WARNING: TSC is not invariant: tick conversions might be wrong\n");
+	}
+
+	tsc_clock_source = clock;
+	tsc_khz = 0;
+	getKhz();
+	return clock;
+}
+
+static inline const char *tsc_clock_name(enum tsc_clock clock)
+{
+	switch (clock) {
+		case TSC_CLOCK_AUTO: return "auto";
+		case TSC_CLOCK_CPU: return "tsc";
+		case TSC_CLOCK_MONOTONIC: return "clock";
+	}
+	return "unknown";
 }
 
 static inline double __tsc_getusecs(uint64_t ticks)
 {
 	uint64_t khz = getKhz();
-	return (double)ticks/(double)(1000*khz/1000000);
+	return (double)ticks*1000.0/(double)khz;
 }
 
 static inline double __tsc_getsecs(uint64_t ticks)
@@ -157,6 +295,12 @@ static inline double __tsc_getsecs(uint64_t ticks)
 	uint64_t khz = getKhz();
 	return (double)ticks/(double)(1000*khz);
 }
+static inline uint64_t __tsc_secs2ticks(double secs)
+{
+	uint64_t khz = getKhz();
+	return (uint64_t)(secs*(double)(1000*khz));
+}
+
 static inline double tsc_getsecs(tsc_t *tsc)
 {
 	return __tsc_getsecs(tsc->ticks);
@@ -0,0 +1,260 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+static inline int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int
+sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int
+uring_init(struct uring *ring, unsigned entries, unsigned flags) {
+    struct io_uring_params p = (struct io_uring_params){0};
+    int err;
+
+    *ring = (struct uring){0};
+    p.flags = flags;
+    if (flags & IORING_SETUP_SQPOLL)
+        p.sq_thread_idle = 1000; // msecs
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0)
+        return -errno;
+    ring->setup_flags = flags;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_khead   = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_ktail   = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_kflags  = (unsigned *)(sq + p.sq_off.flags);
+    ring->sq_array   = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_mask    = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    ring->cq_khead   = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_ktail   = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask    = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // we always use the sqes in order, so the indirection array is static
+    for (unsigned i=0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+    ring->sqe_head = ring->sqe_tail = *ring->sq_khead;
+
+    return 0;
+
+fail:
+    err = -errno;
+    uring_exit(ring);
+    return err;
+}
+
+void
+uring_exit(struct uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    *ring = (struct uring){0};
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *
+uring_get_sqe(struct uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+        return NULL;
+    return &ring->sqes[ring->sqe_tail++ & ring->sq_mask];
+}
+
+// publish the local sqes to the kernel, returns the number of new sqes
+static unsigned
+uring_flush_sq(struct uring *ring) {
+    unsigned n = ring->sqe_tail - ring->sqe_head;
+    if (n) {
+        __atomic_store_n(ring->sq_ktail, ring->sqe_tail, __ATOMIC_RELEASE);
+        ring->sqe_head = ring->sqe_tail;
+    }
+    return n;
+}
+
+int
+uring_submit_and_wait(struct uring *ring, unsigned wait_nr) {
+    unsigned to_submit = uring_flush_sq(ring);
+    unsigned flags = 0;
+
+    if (ring->setup_flags & IORING_SETUP_SQPOLL) {
+        // the kernel thread picks up sqes on its own, unless it went to sleep
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(ring->sq_kflags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if (wait_nr == 0)
+            return to_submit;
+    } else if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+
+    if (wait_nr)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    for (;;) {
+        int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+        if (ret >= 0)
+            return ret;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+struct io_uring_cqe *
+uring_wait_cqe(struct uring *ring) {
+    struct io_uring_cqe *cqe;
+
+    // submit whatever is pending without blocking first, so that
+    // completions for it can be reaped.
+    int ret = uring_submit(ring);
+    for (;;) {
+        if (ret < 0) {
+            errno = -ret;
+            return NULL;
+        }
+        if ((cqe = uring_peek_cqe(ring)) != NULL)
+            return cqe;
+        ret = uring_submit_and_wait(ring, 1);
+    }
+}
+
+int
+uring_register_buffers(struct uring *ring, const struct iovec *iovs, unsigned nr) {
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, nr) < 0)
+        return -errno;
+    return 0;
+}
+
+int
+uring_register_buffers_sparse(struct uring *ring, unsigned nr) {
+    struct io_uring_rsrc_register reg = (struct io_uring_rsrc_register){0};
+
+    reg.nr = nr;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) < 0)
+        return -errno;
+    return 0;
+}
+
+int
+uring_update_buffer(struct uring *ring, unsigned idx, const struct iovec *iov) {
+    struct io_uring_rsrc_update2 up = (struct io_uring_rsrc_update2){0};
+
+    up.offset = idx;
+    up.data = (uint64_t)(uintptr_t)iov;
+    up.nr = 1;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) < 0)
+        return -errno;
+    return 0;
+}
+
+int
+uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *br,
+                    uint16_t bgid, unsigned nbufs, size_t buf_size) {
+    struct io_uring_buf_reg reg = (struct io_uring_buf_reg){0};
+    int err;
+
+    if (nbufs == 0 || (nbufs & (nbufs - 1)) != 0)
+        return -EINVAL;
+
+    *br = (struct uring_buf_ring){0};
+    br->bgid = bgid;
+    br->nbufs = nbufs;
+    br->mask = nbufs - 1;
+    br->buf_size = buf_size;
+    br->br_size = nbufs*sizeof(struct io_uring_buf);
+
+    // ring needs to be page-aligned
+    br->br = mmap(NULL, br->br_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (br->br == MAP_FAILED)
+        return -errno;
+
+    br->bufs = mmap(NULL, nbufs*buf_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (br->bufs == MAP_FAILED) {
+        err = -errno;
+        munmap(br->br, br->br_size);
+        return err;
+    }
+
+    reg.ring_addr = (uint64_t)(uintptr_t)br->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        err = -errno;
+        munmap(br->bufs, nbufs*buf_size);
+        munmap(br->br, br->br_size);
+        return err;
+    }
+
+    br->br->tail = 0;
+    for (unsigned i=0; i < nbufs; i++)
+        uring_buf_ring_recycle(br, i);
+
+    return 0;
+}
+
+void
+uring_buf_ring_free(struct uring_buf_ring *br) {
+    if (br->bufs)
+        munmap(br->bufs, br->nbufs*br->buf_size);
+    if (br->br)
+        munmap(br->br, br->br_size);
+    *br = (struct uring_buf_ring){0};
+}
@@ -0,0 +1,135 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+#ifndef URING_H__
+#define URING_H__
+
+// Minimal io_uring wrapper on top of the raw syscalls (no liburing).
+//
+// Only what rrbench needs is here: ring setup (optionally with SQPOLL),
+// submission/completion, registered buffers (dense and sparse), and provided
+// buffer rings.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct uring {
+    int fd;
+    unsigned setup_flags;
+
+    // submission queue
+    unsigned *sq_khead, *sq_ktail, *sq_kflags, *sq_array;
+    unsigned sq_mask, sq_entries;
+    unsigned sqe_head, sqe_tail; // local: sqes [sqe_head, sqe_tail) are not yet submitted
+    struct io_uring_sqe *sqes;
+
+    // completion queue
+    unsigned *cq_khead, *cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+// provided buffer ring: @nbufs buffers of @buf_size bytes each
+struct uring_buf_ring {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint16_t bgid;
+    unsigned nbufs, mask;
+    size_t buf_size;
+    char *bufs;
+};
+
+// setup a ring with IORING_SETUP_* @flags. returns 0 or -errno
+int uring_init(struct uring *ring, unsigned entries, unsigned flags);
+void uring_exit(struct uring *ring);
+
+// returns NULL if the SQ is full (call uring_submit() and retry)
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// submit pending sqes, and wait for at least @wait_nr completions
+// returns number of sqes submitted or -errno
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr);
+
+static inline int
+uring_submit(struct uring *ring) {
+    return uring_submit_and_wait(ring, 0);
+}
+
+// returns the next cqe or NULL if there are none
+static inline struct io_uring_cqe *
+uring_peek_cqe(struct uring *ring) {
+    unsigned head = *ring->cq_khead;
+    unsigned tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+static inline void
+uring_cqe_seen(struct uring *ring) {
+    __atomic_store_n(ring->cq_khead, *ring->cq_khead + 1, __ATOMIC_RELEASE);
+}
+
+// wait for a cqe (submitting pending sqes first)
+// returns the cqe, or NULL on error (errno is set)
+struct io_uring_cqe *uring_wait_cqe(struct uring *ring);
+
+// register a dense table of @nr buffers. returns 0 or -errno
+int uring_register_buffers(struct uring *ring, const struct iovec *iovs, unsigned nr);
+// register a sparse table of @nr (empty) buffers, that can be later set with
+// uring_update_buffer(). returns 0 or -errno
+int uring_register_buffers_sparse(struct uring *ring, unsigned nr);
+int uring_update_buffer(struct uring *ring, unsigned idx, const struct iovec *iov);
+
+// register a provided buffer ring with @nbufs (power of 2) buffers
+// returns 0 or -errno
+int uring_buf_ring_init(struct uring *ring, struct uring_buf_ring *br,
+                        uint16_t bgid, unsigned nbufs, size_t buf_size);
+
+// free the memory of a buffer ring. The ring should be either unregistered, or
+// (as rrbench does) the io_uring instance it was registered with already exited.
+void uring_buf_ring_free(struct uring_buf_ring *br);
+
+static inline char *
+uring_buf_ring_buf(struct uring_buf_ring *br, uint16_t bid) {
+    return br->bufs + (size_t)bid*br->buf_size;
+}
+
+// return buffer @bid to the kernel
+static inline void
+uring_buf_ring_recycle(struct uring_buf_ring *br, uint16_t bid) {
+    uint16_t tail = br->br->tail;
+    struct io_uring_buf *buf = &br->br->bufs[tail & br->mask];
+
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_buf(br, bid);
+    buf->len  = br->buf_size;
+    buf->bid  = bid;
+    __atomic_store_n(&br->br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+uring_sqe_prep(struct io_uring_sqe *sqe, uint8_t op, int fd,
+               const void *addr, uint32_t len, uint64_t user_data) {
+    *sqe = (struct io_uring_sqe){0};
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->user_data = user_data;
+}
+
+#if defined(__cplusplus)
+} // end  extern "C"
+#endif
+
+#endif /* URING_H__ */
@@ -0,0 +1,281 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+
+#include "xsk.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+static inline int
+sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int
+xsk_ring_map(struct xsk *xsk, struct xsk_ring *r, const struct xdp_ring_offset *off,
+             unsigned size, size_t desc_size, off_t pgoff) {
+    r->map_size = off->desc + size*desc_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, xsk->fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -errno;
+    }
+
+    char *m = r->map;
+    r->producer = (uint32_t *)(m + off->producer);
+    r->consumer = (uint32_t *)(m + off->consumer);
+    r->flags    = (uint32_t *)(m + off->flags);
+    r->descs    = m + off->desc;
+    r->size     = size;
+    r->mask     = size - 1;
+    return 0;
+}
+
+static void
+xsk_ring_unmap(struct xsk_ring *r) {
+    if (r->map)
+        munmap(r->map, r->map_size);
+    r->map = NULL;
+}
+
+int
+xsk_init(struct xsk *xsk, int ifindex, unsigned queue,
+         unsigned nframes, size_t frame_size, unsigned ring_size) {
+    struct xdp_mmap_offsets off;
+    socklen_t optlen;
+    int err;
+
+    *xsk = (struct xsk){0};
+    xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+    if (nframes > ring_size || (ring_size & (ring_size - 1)))
+        return -EINVAL;
+
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0)
+        return -errno;
+
+    xsk->nframes = nframes;
+    xsk->frame_size = frame_size;
+    xsk->umem_size = nframes*frame_size;
+    xsk->umem = mmap(NULL, xsk->umem_size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    if (xsk->umem == MAP_FAILED) {
+        xsk->umem = NULL;
+        goto fail;
+    }
+
+    struct xdp_umem_reg reg = {
+        .addr = (uint64_t)(uintptr_t)xsk->umem,
+        .len = xsk->umem_size,
+        .chunk_size = frame_size,
+        .headroom = 0,
+    };
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+        goto fail;
+
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0)
+        goto fail;
+
+    optlen = sizeof(off);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+        goto fail;
+
+    if ((err = xsk_ring_map(xsk, &xsk->fill, &off.fr, ring_size, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING)) ||
+        (err = xsk_ring_map(xsk, &xsk->comp, &off.cr, ring_size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)) ||
+        (err = xsk_ring_map(xsk, &xsk->rx, &off.rx, ring_size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)) ||
+        (err = xsk_ring_map(xsk, &xsk->tx, &off.tx, ring_size, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))) {
+        errno = -err;
+        goto fail;
+    }
+
+    // give all frames to the kernel for receiving
+    for (unsigned i=0; i < nframes; i++)
+        *xsk_fill_addr(xsk, i) = (uint64_t)i*frame_size;
+    xsk_ring_prod_submit(&xsk->fill, nframes);
+
+    // let the kernel choose between zero-copy and copy mode
+    struct sockaddr_xdp sxdp = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = queue,
+        .sxdp_flags = XDP_USE_NEED_WAKEUP,
+    };
+    if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    err = -errno;
+    xsk_fini(xsk);
+    return err;
+}
+
+void
+xsk_fini(struct xsk *xsk) {
+    if (xsk->link_fd >= 0)
+        close(xsk->link_fd);
+    if (xsk->prog_fd >= 0)
+        close(xsk->prog_fd);
+    if (xsk->map_fd >= 0)
+        close(xsk->map_fd);
+    xsk_ring_unmap(&xsk->rx);
+    xsk_ring_unmap(&xsk->tx);
+    xsk_ring_unmap(&xsk->fill);
+    xsk_ring_unmap(&xsk->comp);
+    if (xsk->fd >= 0)
+        close(xsk->fd);
+    if (xsk->umem)
+        munmap(xsk->umem, xsk->umem_size);
+    *xsk = (struct xsk){0};
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+}
+
+#define INSN(code_, dst_, src_, off_, imm_) \
+    ((struct bpf_insn){ .code = (code_), .dst_reg = (dst_), .src_reg = (src_), .off = (off_), .imm = (imm_) })
+
+#define MOV64_REG(dst, src)      INSN(BPF_ALU64|BPF_MOV|BPF_X, dst, src, 0, 0)
+#define MOV64_IMM(dst, imm)      INSN(BPF_ALU64|BPF_MOV|BPF_K, dst, 0, 0, imm)
+#define ADD64_IMM(dst, imm)      INSN(BPF_ALU64|BPF_ADD|BPF_K, dst, 0, 0, imm)
+#define LDX_MEM(sz, dst, src, off) INSN(BPF_LDX|BPF_MEM|(sz), dst, src, off, 0)
+#define JGT_REG(dst, src, off)   INSN(BPF_JMP|BPF_JGT|BPF_X, dst, src, off, 0)
+#define JEQ_IMM(dst, imm, off)   INSN(BPF_JMP|BPF_JEQ|BPF_K, dst, 0, off, imm)
+#define JNE_IMM(dst, imm, off)   INSN(BPF_JMP|BPF_JNE|BPF_K, dst, 0, off, imm)
+#define JA(off)                  INSN(BPF_JMP|BPF_JA, 0, 0, off, 0)
+#define CALL(fn)                 INSN(BPF_JMP|BPF_CALL, 0, 0, 0, fn)
+#define EXIT()                   INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0)
+#define LD_MAP_FD(dst, fd)       INSN(BPF_LD|BPF_DW|BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+
+// offsets in the packet
+#define ETH_PROTO_OFF  12
+#define IP4_OFF        ETH_HLEN
+#define IP4_PROTO_OFF  (IP4_OFF + 9)
+#define IP4_UDP_END    (IP4_OFF + 20 + 8)
+#define IP4_DPORT_OFF  (IP4_OFF + 20 + 2)
+#define IP6_OFF        ETH_HLEN
+#define IP6_NEXT_OFF   (IP6_OFF + 6)
+#define IP6_UDP_END    (IP6_OFF + 40 + 8)
+#define IP6_DPORT_OFF  (IP6_OFF + 40 + 2)
+
+int
+xsk_attach_prog(struct xsk *xsk, int ifindex, unsigned queue, uint16_t port,
+                char *log, size_t log_size) {
+    union bpf_attr attr;
+    int err;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queue + 1;
+    xsk->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (xsk->map_fd < 0)
+        return -errno;
+
+    // Jump offsets are relative to the next instruction. Labels: V6 = 19,
+    // REDIRECT = 26, PASS = 32.
+    const int16_t port_be = htons(port);
+    struct bpf_insn prog[] = {
+        /*  0 */ MOV64_REG(BPF_REG_6, BPF_REG_1),
+        /*  1 */ LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+        /*  2 */ LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+        /*  3 */ MOV64_REG(BPF_REG_4, BPF_REG_2),
+        /*  4 */ ADD64_IMM(BPF_REG_4, ETH_HLEN),
+        /*  5 */ JGT_REG(BPF_REG_4, BPF_REG_3, 32 - 6),
+        /*  6 */ LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, ETH_PROTO_OFF),
+        /*  7 */ JEQ_IMM(BPF_REG_5, htons(ETH_P_IPV6), 19 - 8),
+        /*  8 */ JNE_IMM(BPF_REG_5, htons(ETH_P_IP), 32 - 9),
+        // IPv4
+        /*  9 */ MOV64_REG(BPF_REG_4, BPF_REG_2),
+        /* 10 */ ADD64_IMM(BPF_REG_4, IP4_UDP_END),
+        /* 11 */ JGT_REG(BPF_REG_4, BPF_REG_3, 32 - 12),
+        /* 12 */ LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, IP4_OFF),
+        /* 13 */ JNE_IMM(BPF_REG_5, 0x45, 32 - 14), // no options
+        /* 14 */ LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, IP4_PROTO_OFF),
+        /* 15 */ JNE_IMM(BPF_REG_5, IPPROTO_UDP, 32 - 16),
+        /* 16 */ LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, IP4_DPORT_OFF),
+        /* 17 */ JNE_IMM(BPF_REG_5, (uint16_t)port_be, 32 - 18),
+        /* 18 */ JA(26 - 19),
+        // IPv6
+        /* 19 */ MOV64_REG(BPF_REG_4, BPF_REG_2),
+        /* 20 */ ADD64_IMM(BPF_REG_4, IP6_UDP_END),
+        /* 21 */ JGT_REG(BPF_REG_4, BPF_REG_3, 32 - 22),
+        /* 22 */ LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, IP6_NEXT_OFF),
+        /* 23 */ JNE_IMM(BPF_REG_5, IPPROTO_UDP, 32 - 24),
+        /* 24 */ LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, IP6_DPORT_OFF),
+        /* 25 */ JNE_IMM(BPF_REG_5, (uint16_t)port_be, 32 - 26),
+        // REDIRECT: bpf_redirect_map(map, rx_queue_index, XDP_PASS)
+        /* 26 */ LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)),
+        /* 27 */ LD_MAP_FD(BPF_REG_1, xsk->map_fd),
+        /* 29 */ MOV64_IMM(BPF_REG_3, XDP_PASS),
+        /* 30 */ CALL(BPF_FUNC_redirect_map),
+        /* 31 */ EXIT(),
+        // PASS
+        /* 32 */ MOV64_IMM(BPF_REG_0, XDP_PASS),
+        /* 33 */ EXIT(),
+    };
+
+    static const char license[] = "GPL";
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uint64_t)(uintptr_t)license;
+    if (log && log_size > 0) {
+        log[0] = '\0';
+        attr.log_buf = (uint64_t)(uintptr_t)log;
+        attr.log_size = log_size;
+        attr.log_level = 1;
+    }
+    xsk->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (xsk->prog_fd < 0)
+        return -errno;
+
+    uint32_t key = queue, val = xsk->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xsk->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&val;
+    attr.flags = BPF_ANY;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+        return -errno;
+
+    // native XDP if the driver supports it, generic otherwise
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xsk->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    xsk->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (xsk->link_fd < 0) {
+        err = -errno;
+        if (log && log_size > 0)
+            snprintf(log, log_size, "BPF_LINK_CREATE failed (is another XDP program attached?)\n");
+        return err;
+    }
+
+    return 0;
+}
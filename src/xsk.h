@@ -0,0 +1,118 @@
+// vim: set expandtab softtabstop=4 tabstop=4 shiftwidth=4:
+//
+// Kornilios Kourtis <kkourt@kkourt.io>
+//
+#ifndef XSK_H__
+#define XSK_H__
+
+// Minimal AF_XDP wrapper on top of the raw syscalls (no libbpf/libxdp).
+//
+// Only what rrbench needs is here: a UMEM with its fill and completion rings,
+// a socket with its RX and TX rings bound to a single device queue, and a
+// small XDP program that redirects UDP packets to a given port into the
+// socket (and passes everything else to the stack).
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/if_xdp.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct xsk_ring {
+    uint32_t *producer, *consumer, *flags;
+    void *descs;
+    uint32_t mask, size;
+    void *map;
+    size_t map_size;
+};
+
+struct xsk {
+    int fd;
+    struct xsk_ring rx, tx, fill, comp;
+    char *umem;
+    size_t umem_size, frame_size;
+    unsigned nframes;
+    // XDP program and map
+    int map_fd, prog_fd, link_fd;
+};
+
+// create an AF_XDP socket with a UMEM of @nframes frames of @frame_size bytes
+// each, and rings of @ring_size (power of 2) entries, bound to queue @queue of
+// device @ifindex. All frames are placed in the fill ring, so @nframes should
+// be <= @ring_size. returns 0 or -errno
+int xsk_init(struct xsk *xsk, int ifindex, unsigned queue,
+             unsigned nframes, size_t frame_size, unsigned ring_size);
+void xsk_fini(struct xsk *xsk);
+
+// load an XDP program that redirects UDP (IPv4 without options, or IPv6
+// without extension headers) packets with destination port @port (host order)
+// to the socket, and attach it to @ifindex. The program is detached when the
+// socket is closed (xsk_fini()) or the process exits.
+//
+// returns 0 or -errno. If @log is not NULL, the verifier log is stored there
+// on failure.
+int xsk_attach_prog(struct xsk *xsk, int ifindex, unsigned queue, uint16_t port,
+                    char *log, size_t log_size);
+
+static inline void *
+xsk_frame(struct xsk *xsk, uint64_t addr) {
+    return xsk->umem + addr;
+}
+
+// number of entries available to consume
+static inline uint32_t
+xsk_ring_cons_peek(struct xsk_ring *r) {
+    uint32_t prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+    return prod - *r->consumer;
+}
+
+static inline void
+xsk_ring_cons_release(struct xsk_ring *r, uint32_t n) {
+    __atomic_store_n(r->consumer, *r->consumer + n, __ATOMIC_RELEASE);
+}
+
+// number of free entries to produce
+static inline uint32_t
+xsk_ring_prod_free(struct xsk_ring *r) {
+    uint32_t cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+    return r->size - (*r->producer - cons);
+}
+
+static inline void
+xsk_ring_prod_submit(struct xsk_ring *r, uint32_t n) {
+    __atomic_store_n(r->producer, *r->producer + n, __ATOMIC_RELEASE);
+}
+
+static inline bool
+xsk_ring_needs_wakeup(struct xsk_ring *r) {
+    return __atomic_load_n(r->flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+}
+
+// i-th entry after the consumer (RX, completion) or producer (TX, fill)
+static inline struct xdp_desc *
+xsk_rx_desc(struct xsk *xsk, uint32_t i) {
+    return &((struct xdp_desc *)xsk->rx.descs)[(*xsk->rx.consumer + i) & xsk->rx.mask];
+}
+
+static inline struct xdp_desc *
+xsk_tx_desc(struct xsk *xsk, uint32_t i) {
+    return &((struct xdp_desc *)xsk->tx.descs)[(*xsk->tx.producer + i) & xsk->tx.mask];
+}
+
+static inline uint64_t *
+xsk_comp_addr(struct xsk *xsk, uint32_t i) {
+    return &((uint64_t *)xsk->comp.descs)[(*xsk->comp.consumer + i) & xsk->comp.mask];
+}
+
+static inline uint64_t *
+xsk_fill_addr(struct xsk *xsk, uint32_t i) {
+    return &((uint64_t *)xsk->fill.descs)[(*xsk->fill.producer + i) & xsk->fill.mask];
+}
+
+#if defined(__cplusplus)
+} // end  extern "C"
+#endif
+
+#endif /* XSK_H__ */